@@ -0,0 +1,313 @@
+#include "harness.h"
+
+#include <algorithm>
+#include <barrier>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+// Runner and entry point of the benchmark binary.
+//
+// Usage: smart_ptrs_bench [--filter=SUBSTR[,SUBSTR...]] [--format=console|json|csv]
+//                         [--out=FILE] [--min-time=SECONDS] [--repetitions=N] [--list]
+
+namespace {
+
+struct Benchmark {
+    std::string name;
+    BenchmarkFunction function;
+    int threads;
+};
+
+struct Result {
+    std::string name;
+    int threads;
+    size_t iterations;
+    size_t repetitions;
+    // Wall time of one iteration of one thread, over the repetitions
+    double ns_median;
+    double ns_min;
+    double ns_max;
+    double items_per_second;
+};
+
+struct Options {
+    std::vector<std::string> filters;
+    std::string format = "console";
+    std::string out;
+    double min_time = 0.2;
+    size_t repetitions = 5;
+    bool list = false;
+};
+
+std::vector<Benchmark>& Registry() {
+    static std::vector<Benchmark> registry;
+    return registry;
+}
+
+struct Run {
+    double seconds;
+    size_t items_per_iteration;
+};
+
+Run RunOnce(const Benchmark& benchmark, size_t iterations) {
+    if (benchmark.threads == 1) {
+        BenchmarkState state(iterations, 1, 0, [] {});
+        benchmark.function(state);
+        std::chrono::duration<double> elapsed = state.StopTime() - state.StartTime();
+        return {elapsed.count(), state.ItemsPerIteration()};
+    }
+
+    std::barrier start(benchmark.threads);
+    std::vector<BenchmarkState> states;
+    states.reserve(benchmark.threads);
+    for (int i = 0; i < benchmark.threads; ++i) {
+        states.emplace_back(iterations, benchmark.threads, i,
+                            [&start] { start.arrive_and_wait(); });
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < benchmark.threads; ++i) {
+        threads.emplace_back([&benchmark, &state = states[i]] { benchmark.function(state); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto first = states[0].StartTime();
+    auto last = states[0].StopTime();
+    for (const auto& state : states) {
+        first = std::min(first, state.StartTime());
+        last = std::max(last, state.StopTime());
+    }
+    std::chrono::duration<double> elapsed = last - first;
+    return {elapsed.count(), states[0].ItemsPerIteration()};
+}
+
+// Grows the iteration count until one run takes at least `min_time`
+size_t Calibrate(const Benchmark& benchmark, double min_time) {
+    constexpr size_t kMaxIterations = 1'000'000'000;
+    size_t iterations = 1;
+    while (true) {
+        double seconds = RunOnce(benchmark, iterations).seconds;
+        if (seconds >= min_time || iterations >= kMaxIterations) {
+            return iterations;
+        }
+        double multiplier = seconds > min_time / 10 ? min_time * 1.4 / seconds : 10.0;
+        auto next = static_cast<size_t>(static_cast<double>(iterations) * multiplier);
+        iterations = std::min(std::max(next, iterations + 1), kMaxIterations);
+    }
+}
+
+Result Measure(const Benchmark& benchmark, const Options& options) {
+    size_t iterations = Calibrate(benchmark, options.min_time);
+    std::vector<double> ns;
+    double items_per_second = 0;
+    for (size_t i = 0; i < options.repetitions; ++i) {
+        Run run = RunOnce(benchmark, iterations);
+        ns.push_back(run.seconds * 1e9 / static_cast<double>(iterations));
+        items_per_second += static_cast<double>(iterations * benchmark.threads *
+                                                run.items_per_iteration) /
+                            run.seconds;
+    }
+    std::sort(ns.begin(), ns.end());
+    double median = ns.size() % 2 == 1 ? ns[ns.size() / 2]
+                                       : (ns[ns.size() / 2 - 1] + ns[ns.size() / 2]) / 2;
+    return {benchmark.name,
+            benchmark.threads,
+            iterations,
+            options.repetitions,
+            median,
+            ns.front(),
+            ns.back(),
+            items_per_second / static_cast<double>(options.repetitions)};
+}
+
+bool Selected(const Benchmark& benchmark, const Options& options) {
+    if (options.filters.empty()) {
+        return true;
+    }
+    return std::any_of(options.filters.begin(), options.filters.end(), [&](const auto& filter) {
+        return benchmark.name.find(filter) != std::string::npos;
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reporters
+
+std::string Escape(std::string_view text) {
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result;
+}
+
+std::string Timestamp() {
+    std::time_t now = std::time(nullptr);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return buffer;
+}
+
+std::string Compiler() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+void ReportJson(std::ostream& out, const std::vector<Result>& results) {
+    out << "{\n  \"context\": {\n";
+    out << "    \"date\": \"" << Timestamp() << "\",\n";
+    out << "    \"compiler\": \"" << Escape(Compiler()) << "\",\n";
+    out << "    \"build_type\": \"" << SMART_PTRS_BUILD_TYPE << "\",\n";
+    out << "    \"hardware_threads\": " << std::thread::hardware_concurrency() << "\n";
+    out << "  },\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"name\": \"" << Escape(result.name) << "\", \"threads\": " << result.threads
+            << ", \"iterations\": " << result.iterations
+            << ", \"repetitions\": " << result.repetitions
+            << ", \"ns_per_iteration\": " << result.ns_median
+            << ", \"ns_per_iteration_min\": " << result.ns_min
+            << ", \"ns_per_iteration_max\": " << result.ns_max
+            << ", \"items_per_second\": " << result.items_per_second << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void ReportCsv(std::ostream& out, const std::vector<Result>& results) {
+    out << "name,threads,iterations,repetitions,ns_per_iteration,ns_per_iteration_min,"
+           "ns_per_iteration_max,items_per_second\n";
+    for (const Result& result : results) {
+        out << '"' << result.name << "\"," << result.threads << ',' << result.iterations << ','
+            << result.repetitions << ',' << result.ns_median << ',' << result.ns_min << ','
+            << result.ns_max << ',' << result.items_per_second << '\n';
+    }
+}
+
+void ReportConsoleLine(const Result& result) {
+    std::printf("%-48s %12.2f ns %12.2f ns %12.2f ns %14.4g items/s\n", result.name.c_str(),
+                result.ns_median, result.ns_min, result.ns_max, result.items_per_second);
+    std::fflush(stdout);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Command line
+
+bool ParseFlag(std::string_view arg, std::string_view flag, std::string& value) {
+    if (arg.substr(0, flag.size()) != flag || arg.size() <= flag.size() ||
+        arg[flag.size()] != '=') {
+        return false;
+    }
+    value = arg.substr(flag.size() + 1);
+    return true;
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        std::string value;
+        if (ParseFlag(arg, "--filter", value)) {
+            std::stringstream list(value);
+            for (std::string filter; std::getline(list, filter, ',');) {
+                options.filters.push_back(filter);
+            }
+        } else if (ParseFlag(arg, "--format", value)) {
+            options.format = value;
+        } else if (ParseFlag(arg, "--out", value)) {
+            options.out = value;
+        } else if (ParseFlag(arg, "--min-time", value)) {
+            options.min_time = std::stod(value);
+        } else if (ParseFlag(arg, "--repetitions", value)) {
+            options.repetitions = std::max<size_t>(std::stoul(value), 1);
+        } else if (arg == "--list") {
+            options.list = true;
+        } else {
+            std::cerr << "Unknown argument: " << arg << "\n"
+                      << "Usage: " << argv[0]
+                      << " [--filter=SUBSTR[,SUBSTR...]] [--format=console|json|csv]"
+                         " [--out=FILE] [--min-time=SECONDS] [--repetitions=N] [--list]\n";
+            std::exit(2);
+        }
+    }
+    if (options.format != "console" && options.format != "json" && options.format != "csv") {
+        std::cerr << "Unknown format: " << options.format << "\n";
+        std::exit(2);
+    }
+    return options;
+}
+
+}  // namespace
+
+void RegisterBenchmark(std::string name, BenchmarkFunction function, std::vector<int> threads) {
+    for (int count : threads) {
+        std::string full_name = count == 1 ? name : name + "/threads:" + std::to_string(count);
+        Registry().push_back({std::move(full_name), function, count});
+    }
+}
+
+std::vector<int> ThreadCounts() {
+    int hardware = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<int> counts;
+    for (int count = 1; count < hardware; count *= 2) {
+        counts.push_back(count);
+    }
+    counts.push_back(hardware);
+    return counts;
+}
+
+int main(int argc, char** argv) {
+    Options options = ParseOptions(argc, argv);
+
+    if (options.format == "console" && !options.list) {
+        std::printf("%-48s %15s %15s %15s %20s\n", "name", "median", "min", "max", "throughput");
+    }
+    std::vector<Result> results;
+    for (const Benchmark& benchmark : Registry()) {
+        if (!Selected(benchmark, options)) {
+            continue;
+        }
+        if (options.list) {
+            std::printf("%s\n", benchmark.name.c_str());
+            continue;
+        }
+        results.push_back(Measure(benchmark, options));
+        if (options.format == "console") {
+            ReportConsoleLine(results.back());
+        }
+    }
+    if (options.list || options.format == "console") {
+        return 0;
+    }
+
+    std::ofstream file;
+    if (!options.out.empty()) {
+        file.open(options.out);
+        if (!file) {
+            std::cerr << "Cannot open " << options.out << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = options.out.empty() ? std::cout : file;
+    if (options.format == "json") {
+        ReportJson(out, results);
+    } else {
+        ReportCsv(out, results);
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal self-contained benchmark harness, modelled on Google Benchmark:
+//
+//     void BenchCopy(BenchmarkState& state) {
+//         auto ptr = MakeShared<int>(0);        // setup, not timed
+//         for (auto _ : state) {                // timed, `state.Iterations()` times
+//             auto copy = ptr;
+//             DoNotOptimize(copy);
+//         }
+//     }
+//     static const int kRegistered = (RegisterBenchmark("copy/SharedPtr", BenchCopy), 0);
+//
+// A multi-threaded benchmark runs the same function on every thread at once; the timed loops
+// start together and the reported time spans from the first start to the last stop.
+
+class BenchmarkState {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    class Iterator {
+    public:
+        Iterator(BenchmarkState* state, size_t left) : state_(state), left_(left) {
+        }
+        bool operator!=(const Iterator&) const {
+            if (left_ != 0) {
+                return true;
+            }
+            state_->Stop();
+            return false;
+        }
+        void operator++() {
+            --left_;
+        }
+        // Non-trivial, so that the unused loop variable draws no warning
+        struct Value {
+            ~Value() {
+            }
+        };
+        Value operator*() const {
+            return {};
+        }
+
+    private:
+        BenchmarkState* state_;
+        size_t left_;
+    };
+
+    BenchmarkState(size_t iterations, int threads, int thread_index,
+                   std::function<void()> start_barrier)
+        : iterations_(iterations),
+          threads_(threads),
+          thread_index_(thread_index),
+          start_barrier_(std::move(start_barrier)) {
+    }
+
+    Iterator begin() {
+        start_barrier_();
+        start_ = Clock::now();
+        return Iterator(this, iterations_);
+    }
+    Iterator end() {
+        return Iterator(this, 0);
+    }
+
+    size_t Iterations() const {
+        return iterations_;
+    }
+    int Threads() const {
+        return threads_;
+    }
+    int ThreadIndex() const {
+        return thread_index_;
+    }
+    // Work items per iteration, reported as `items_per_second`
+    void SetItemsPerIteration(size_t items) {
+        items_per_iteration_ = items;
+    }
+
+    Clock::time_point StartTime() const {
+        return start_;
+    }
+    Clock::time_point StopTime() const {
+        return stop_;
+    }
+    size_t ItemsPerIteration() const {
+        return items_per_iteration_;
+    }
+
+private:
+    void Stop() {
+        stop_ = Clock::now();
+    }
+
+    size_t iterations_;
+    int threads_;
+    int thread_index_;
+    std::function<void()> start_barrier_;
+    size_t items_per_iteration_ = 1;
+    Clock::time_point start_;
+    Clock::time_point stop_;
+};
+
+using BenchmarkFunction = std::function<void(BenchmarkState&)>;
+
+// Registers `function` once per entry of `threads`, named "name/threads:N" for N > 1
+void RegisterBenchmark(std::string name, BenchmarkFunction function,
+                       std::vector<int> threads = {1});
+
+// 1, 2, 4, ... up to the number of hardware threads, which is always included
+std::vector<int> ThreadCounts();
+
+// Keeps the compiler from optimizing `value` away
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+// Makes pending writes to memory observable
+inline void ClobberMemory() {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : : "memory");
+#endif
+}
@@ -0,0 +1,349 @@
+#include "harness.h"
+
+#include "inline_box.h"
+#include "offset_shared.h"
+#include "shared.h"
+#include "slot_map.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Single-threaded micro-benchmarks, each pairing our pointer with its std counterpart
+
+namespace {
+
+struct Payload {
+    int value = 0;
+    long padding[3] = {};
+};
+
+// Uniform construction of the pointers under test
+struct Ours {
+    template <typename T>
+    using Shared = SharedPtr<T>;
+    template <typename T>
+    using Unique = UniquePtr<T>;
+
+    template <typename T>
+    static Shared<T> Make() {
+        return MakeShared<T>();
+    }
+    template <typename T>
+    static Shared<T> FromNew() {
+        return Shared<T>(new T());
+    }
+    template <typename T>
+    static auto Lock(const WeakPtr<T>& weak) {
+        return weak.Lock();
+    }
+    template <typename T>
+    static WeakPtr<T> Weak(const Shared<T>& shared) {
+        return WeakPtr<T>(shared);
+    }
+};
+
+struct Std {
+    template <typename T>
+    using Shared = std::shared_ptr<T>;
+    template <typename T>
+    using Unique = std::unique_ptr<T>;
+
+    template <typename T>
+    static Shared<T> Make() {
+        return std::make_shared<T>();
+    }
+    template <typename T>
+    static Shared<T> FromNew() {
+        return Shared<T>(new T());
+    }
+    template <typename T>
+    static auto Lock(const std::weak_ptr<T>& weak) {
+        return weak.lock();
+    }
+    template <typename T>
+    static std::weak_ptr<T> Weak(const Shared<T>& shared) {
+        return std::weak_ptr<T>(shared);
+    }
+};
+
+// Copy and destroy the copy: one increment and one decrement
+template <typename Impl>
+void BenchCopy(BenchmarkState& state) {
+    auto ptr = Impl::template Make<Payload>();
+    for (auto _ : state) {
+        auto copy = ptr;
+        DoNotOptimize(copy);
+    }
+}
+
+// The same with the counters in a shared-memory segment
+void BenchCopyOffsetShared(BenchmarkState& state) {
+    ShmSegment segment = ShmSegment::CreateAnonymous(1 << 16);
+    auto ptr = MakeOffsetShared<Payload>(segment);
+    for (auto _ : state) {
+        auto copy = ptr;
+        DoNotOptimize(copy);
+    }
+}
+
+// Two moves per iteration, no counter traffic
+template <typename Impl>
+void BenchMoveShared(BenchmarkState& state) {
+    auto first = Impl::template Make<Payload>();
+    typename Impl::template Shared<Payload> second;
+    for (auto _ : state) {
+        second = std::move(first);
+        first = std::move(second);
+        DoNotOptimize(first);
+    }
+}
+
+template <typename Impl>
+void BenchMoveUnique(BenchmarkState& state) {
+    typename Impl::template Unique<Payload> first(new Payload());
+    typename Impl::template Unique<Payload> second;
+    for (auto _ : state) {
+        second = std::move(first);
+        first = std::move(second);
+        DoNotOptimize(first);
+    }
+}
+
+// Replace the owned object: one allocation, one destruction
+template <typename Impl>
+void BenchReset(BenchmarkState& state) {
+    auto ptr = Impl::template FromNew<Payload>();
+    for (auto _ : state) {
+        ptr.reset(new Payload());
+        DoNotOptimize(ptr);
+    }
+}
+
+template <>
+void BenchReset<Ours>(BenchmarkState& state) {
+    auto ptr = Ours::FromNew<Payload>();
+    for (auto _ : state) {
+        ptr.Reset(new Payload());
+        DoNotOptimize(ptr);
+    }
+}
+
+template <typename Impl>
+void BenchMakeShared(BenchmarkState& state) {
+    for (auto _ : state) {
+        auto ptr = Impl::template Make<Payload>();
+        DoNotOptimize(ptr);
+    }
+}
+
+template <typename Impl>
+void BenchSharedFromNew(BenchmarkState& state) {
+    for (auto _ : state) {
+        auto ptr = Impl::template FromNew<Payload>();
+        DoNotOptimize(ptr);
+    }
+}
+
+template <typename Impl>
+void BenchUniqueFromNew(BenchmarkState& state) {
+    for (auto _ : state) {
+        typename Impl::template Unique<Payload> ptr(new Payload());
+        DoNotOptimize(ptr);
+    }
+}
+
+// Hands ownership down `depth` calls and back. With a non-trivial ABI every call passes a pointer
+// to a stack slot; built by clang with `SMART_PTRS_TRIVIAL_ABI`, `UniquePtr` stays in a register
+// like the raw pointer.
+template <typename Ptr>
+[[gnu::noinline]] Ptr PassDown(Ptr ptr, int depth) {
+    if (depth == 0) {
+        return ptr;
+    }
+    return PassDown(std::move(ptr), depth - 1);
+}
+
+template <typename Ptr>
+void BenchPassChain(BenchmarkState& state) {
+    constexpr int kDepth = 8;
+    Ptr ptr(new Payload());
+    for (auto _ : state) {
+        ptr = PassDown(std::move(ptr), kDepth);
+        DoNotOptimize(ptr);
+    }
+    if constexpr (std::is_pointer_v<Ptr>) {
+        delete ptr;
+    }
+}
+
+// A small polymorphic object created, called once and destroyed
+struct Handler {
+    virtual ~Handler() = default;
+    virtual int Handle() const = 0;
+};
+
+struct SmallHandler : Handler {
+    int value = 1;
+    int Handle() const override {
+        return value;
+    }
+};
+
+void BenchPolymorphicUnique(BenchmarkState& state) {
+    for (auto _ : state) {
+        UniquePtr<Handler> handler(new SmallHandler());
+        DoNotOptimize(handler->Handle());
+    }
+}
+
+void BenchPolymorphicInlineBox(BenchmarkState& state) {
+    for (auto _ : state) {
+        auto handler = MakeInlineBox<Handler, SmallHandler>();
+        DoNotOptimize(handler->Handle());
+    }
+}
+
+// Promote a weak pointer to a live object and drop the result
+template <typename Impl>
+void BenchLock(BenchmarkState& state) {
+    auto ptr = Impl::template Make<Payload>();
+    auto weak = Impl::Weak(ptr);
+    for (auto _ : state) {
+        auto locked = Impl::Lock(weak);
+        DoNotOptimize(locked);
+    }
+}
+
+template <typename Impl>
+void BenchLockExpired(BenchmarkState& state) {
+    // The temporary owner dies right away
+    auto weak = Impl::Weak(Impl::template Make<Payload>());
+    for (auto _ : state) {
+        auto locked = Impl::Lock(weak);
+        DoNotOptimize(locked);
+    }
+}
+
+// Two reallocations of a vector of 1024 pointers. Elements are moved only if the move
+// constructor is noexcept, otherwise `std::vector` copies and destroys them.
+template <typename Impl>
+void BenchVectorRelocation(BenchmarkState& state) {
+    constexpr size_t kSize = 1024;
+    auto ptr = Impl::template Make<Payload>();
+    std::vector<typename Impl::template Shared<Payload>> vector(kSize, ptr);
+    state.SetItemsPerIteration(2 * kSize);
+    for (auto _ : state) {
+        vector.reserve(2 * kSize);
+        vector.shrink_to_fit();
+        DoNotOptimize(vector.data());
+    }
+}
+
+// The same with `memcpy` growth
+void BenchRelocVectorRelocation(BenchmarkState& state) {
+    constexpr size_t kSize = 1024;
+    auto ptr = MakeShared<Payload>();
+    RelocVector<SharedPtr<Payload>> vector;
+    for (size_t i = 0; i < kSize; ++i) {
+        vector.PushBack(ptr);
+    }
+    state.SetItemsPerIteration(2 * kSize);
+    for (auto _ : state) {
+        vector.Reserve(2 * kSize);
+        vector.ShrinkToFit();
+        DoNotOptimize(vector.Data());
+    }
+}
+
+// Visit 64K live objects through their weak references, in random order
+void BenchWeakRefs(BenchmarkState& state) {
+    constexpr size_t kSize = 1 << 16;
+    std::vector<SharedPtr<Payload>> owners;
+    std::vector<WeakPtr<Payload>> refs;
+    for (size_t i = 0; i < kSize; ++i) {
+        owners.push_back(MakeShared<Payload>());
+        refs.emplace_back(owners.back());
+    }
+    std::shuffle(refs.begin(), refs.end(), std::mt19937(42));
+    state.SetItemsPerIteration(kSize);
+    for (auto _ : state) {
+        for (const WeakPtr<Payload>& ref : refs) {
+            if (auto locked = ref.Lock()) {
+                ++locked->value;
+            }
+        }
+    }
+}
+
+// The same through generational handles
+void BenchSlotHandles(BenchmarkState& state) {
+    constexpr size_t kSize = 1 << 16;
+    SlotMap<Payload> map;
+    std::vector<SlotHandle<Payload>> refs;
+    for (size_t i = 0; i < kSize; ++i) {
+        refs.push_back(map.Insert());
+    }
+    std::shuffle(refs.begin(), refs.end(), std::mt19937(42));
+    state.SetItemsPerIteration(kSize);
+    for (auto _ : state) {
+        for (SlotHandle<Payload> ref : refs) {
+            if (Payload* payload = map.Get(ref)) {
+                ++payload->value;
+            }
+        }
+    }
+    DoNotOptimize(map.begin());
+}
+
+// The same objects visited by a linear scan of the map
+void BenchSlotMapScan(BenchmarkState& state) {
+    constexpr size_t kSize = 1 << 16;
+    SlotMap<Payload> map;
+    for (size_t i = 0; i < kSize; ++i) {
+        map.Insert();
+    }
+    state.SetItemsPerIteration(kSize);
+    for (auto _ : state) {
+        for (Payload& payload : map) {
+            ++payload.value;
+        }
+        DoNotOptimize(map.begin());
+    }
+}
+
+void RegisterPair(const std::string& name, BenchmarkFunction ours, BenchmarkFunction reference) {
+    RegisterBenchmark(name + "/ours", std::move(ours));
+    RegisterBenchmark(name + "/std", std::move(reference));
+}
+
+[[maybe_unused]] const int kRegistered = [] {
+    RegisterPair("copy", BenchCopy<Ours>, BenchCopy<Std>);
+    RegisterBenchmark("copy/ours_offset_shared", BenchCopyOffsetShared);
+    RegisterPair("move", BenchMoveShared<Ours>, BenchMoveShared<Std>);
+    RegisterPair("reset", BenchReset<Ours>, BenchReset<Std>);
+    RegisterPair("make_shared", BenchMakeShared<Ours>, BenchMakeShared<Std>);
+    RegisterPair("shared_from_new", BenchSharedFromNew<Ours>, BenchSharedFromNew<Std>);
+    RegisterPair("lock", BenchLock<Ours>, BenchLock<Std>);
+    RegisterPair("lock_expired", BenchLockExpired<Ours>, BenchLockExpired<Std>);
+    RegisterPair("vector_relocation", BenchVectorRelocation<Ours>, BenchVectorRelocation<Std>);
+    RegisterBenchmark("vector_relocation/ours_reloc_vector", BenchRelocVectorRelocation);
+    RegisterPair("unique_move", BenchMoveUnique<Ours>, BenchMoveUnique<Std>);
+    RegisterPair("unique_from_new", BenchUniqueFromNew<Ours>, BenchUniqueFromNew<Std>);
+    RegisterPair("unique_pass_chain", BenchPassChain<Ours::Unique<Payload>>,
+                 BenchPassChain<Std::Unique<Payload>>);
+    RegisterBenchmark("unique_pass_chain/raw", BenchPassChain<Payload*>);
+    RegisterBenchmark("polymorphic/unique_ptr", BenchPolymorphicUnique);
+    RegisterBenchmark("polymorphic/inline_box", BenchPolymorphicInlineBox);
+    RegisterBenchmark("weak_refs/weak_ptr_lock", BenchWeakRefs);
+    RegisterBenchmark("weak_refs/slot_map_get", BenchSlotHandles);
+    RegisterBenchmark("weak_refs/slot_map_scan", BenchSlotMapScan);
+    return 0;
+}();
+
+}  // namespace
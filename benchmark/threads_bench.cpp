@@ -0,0 +1,135 @@
+#include "harness.h"
+
+#include "atomic_shared.h"
+#include "biased.h"
+#include "shared.h"
+#include "snapshot.h"
+#include "treiber_stack.h"
+#include "weak.h"
+
+#include <memory>
+#include <utility>
+
+// Multi-threaded scaling, from one thread up to the number of hardware threads
+
+namespace {
+
+struct Payload {
+    int value = 0;
+    long padding[3] = {};
+};
+
+template <typename Policy>
+struct Ours {
+    using Shared = SharedPtr<Payload, Policy>;
+    using Weak = WeakPtr<Payload, Policy>;
+
+    static Shared Make() {
+        return MakeShared<Payload, Policy>();
+    }
+    static Shared Lock(const Weak& weak) {
+        return weak.Lock();
+    }
+};
+
+struct Std {
+    using Shared = std::shared_ptr<Payload>;
+    using Weak = std::weak_ptr<Payload>;
+
+    static Shared Make() {
+        return std::make_shared<Payload>();
+    }
+    static Shared Lock(const Weak& weak) {
+        return weak.lock();
+    }
+};
+
+// Every thread copies the same pointer, so all of them hit one counter
+template <typename Impl>
+void BenchCopyShared(BenchmarkState& state) {
+    static const typename Impl::Shared kShared = Impl::Make();
+    for (auto _ : state) {
+        auto copy = kShared;
+        DoNotOptimize(copy);
+    }
+}
+
+// Every thread copies a pointer of its own: should scale linearly
+template <typename Impl>
+void BenchCopyPrivate(BenchmarkState& state) {
+    auto ptr = Impl::Make();
+    for (auto _ : state) {
+        auto copy = ptr;
+        DoNotOptimize(copy);
+    }
+}
+
+template <typename Impl>
+void BenchLockShared(BenchmarkState& state) {
+    static const typename Impl::Shared kShared = Impl::Make();
+    static const typename Impl::Weak kWeak = kShared;
+    for (auto _ : state) {
+        auto locked = Impl::Lock(kWeak);
+        DoNotOptimize(locked);
+    }
+}
+
+// Allocation and destruction of private objects, mostly a test of the allocator
+template <typename Impl>
+void BenchMakeDestroy(BenchmarkState& state) {
+    for (auto _ : state) {
+        auto ptr = Impl::Make();
+        DoNotOptimize(ptr);
+    }
+}
+
+// Macro workload: every thread pushes and pops on one lock-free stack
+void BenchTreiberStack(BenchmarkState& state) {
+    static TreiberStack<int> stack;
+    for (auto _ : state) {
+        stack.Push(state.ThreadIndex());
+        auto value = stack.Pop();
+        DoNotOptimize(value);
+    }
+}
+
+// Read-mostly lookups of one published value: a counted load against an epoch-guarded borrow
+void BenchAtomicSharedLoad(BenchmarkState& state) {
+    static AtomicSharedPtr<Payload> published(MakeShared<Payload, AtomicPolicy>());
+    for (auto _ : state) {
+        auto current = published.Load();
+        DoNotOptimize(current->value);
+    }
+}
+
+void BenchSnapshotRead(BenchmarkState& state) {
+    static Snapshot<Payload> published(MakeShared<Payload, AtomicPolicy>());
+    for (auto _ : state) {
+        auto current = published.Read();
+        DoNotOptimize(current->value);
+    }
+}
+
+template <typename Impl>
+void RegisterAll(const std::string& impl) {
+    RegisterBenchmark("threads/copy_shared/" + impl, BenchCopyShared<Impl>, ThreadCounts());
+    RegisterBenchmark("threads/copy_private/" + impl, BenchCopyPrivate<Impl>, ThreadCounts());
+    RegisterBenchmark("threads/lock_shared/" + impl, BenchLockShared<Impl>, ThreadCounts());
+    RegisterBenchmark("threads/make_destroy/" + impl, BenchMakeDestroy<Impl>, ThreadCounts());
+}
+
+[[maybe_unused]] const int kRegistered = [] {
+    RegisterAll<Ours<AtomicPolicy>>("ours_atomic");
+    RegisterAll<Std>("std");
+    // Biased blocks pay off when every thread keeps to its own objects
+    RegisterBenchmark("threads/copy_private/ours_biased", BenchCopyPrivate<Ours<BiasedPolicy>>,
+                      ThreadCounts());
+    RegisterBenchmark("threads/make_destroy/ours_biased", BenchMakeDestroy<Ours<BiasedPolicy>>,
+                      ThreadCounts());
+    RegisterBenchmark("treiber_stack/push_pop", BenchTreiberStack, ThreadCounts());
+    RegisterBenchmark("read_mostly/atomic_shared_load", BenchAtomicSharedLoad, ThreadCounts());
+    RegisterBenchmark("read_mostly/snapshot_read", BenchSnapshotRead, ThreadCounts());
+    return 0;
+}();
+
+}  // namespace
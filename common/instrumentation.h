@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+
+// Opt-in instrumentation of reference counting, enabled by compiling with
+// `-DSMART_PTRS_INSTRUMENTATION` (CMake: `-DSMART_PTRS_INSTRUMENTATION=ON`).
+//
+// Every control block then carries a pointer to the statistics of its object type, which count
+// allocations, live and peak live objects, strong and weak increments and objects that are
+// already destroyed but whose control block is still held by weak references. `UniquePtr`
+// counts the objects it deletes. `SnapshotStats()` and `DumpStats()` report the numbers.
+//
+// Without the flag `StatsHandle` is an empty class with empty inline members and the control
+// block stores it as `[[no_unique_address]]`, so neither the layout nor the generated code
+// changes. `SnapshotStats()` then returns nothing.
+
+#ifdef SMART_PTRS_INSTRUMENTATION
+inline constexpr bool kInstrumentation = true;
+#else
+inline constexpr bool kInstrumentation = false;
+#endif
+
+// Values of one type's counters at some point in time
+struct TypeStatsSnapshot {
+    std::string type;
+    size_t allocations = 0;
+    size_t live = 0;
+    size_t peak_live = 0;
+    size_t strong_increments = 0;
+    size_t weak_increments = 0;
+    // Destroyed objects whose control block is kept by weak references
+    size_t weak_only = 0;
+    size_t unique_deletes = 0;
+};
+
+// Counters of one type, created on first use and never destroyed
+class TypeStats {
+public:
+    explicit TypeStats(std::string type) : type_(std::move(type)) {
+        TypeStats* head = Head().load(std::memory_order_relaxed);
+        do {
+            next_ = head;
+        } while (!Head().compare_exchange_weak(head, this, std::memory_order_release,
+                                               std::memory_order_relaxed));
+    }
+
+    template <typename T>
+    static TypeStats& For() {
+        static TypeStats* stats = new TypeStats(TypeName<T>());
+        return *stats;
+    }
+
+    void OnCreate() {
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        blocks_.fetch_add(1, std::memory_order_relaxed);
+        size_t live = live_.fetch_add(1, std::memory_order_relaxed) + 1;
+        size_t peak = peak_live_.load(std::memory_order_relaxed);
+        while (live > peak &&
+               !peak_live_.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    }
+    void OnDestroyObject() {
+        live_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    void OnFreeBlock() {
+        blocks_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    void OnStrongIncrement(size_t count) {
+        strong_increments_.fetch_add(count, std::memory_order_relaxed);
+    }
+    void OnWeakIncrement() {
+        weak_increments_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void OnUniqueDelete() {
+        unique_deletes_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    TypeStatsSnapshot Snapshot() const {
+        TypeStatsSnapshot snapshot;
+        snapshot.type = type_;
+        snapshot.allocations = allocations_.load(std::memory_order_relaxed);
+        snapshot.live = live_.load(std::memory_order_relaxed);
+        snapshot.peak_live = peak_live_.load(std::memory_order_relaxed);
+        snapshot.strong_increments = strong_increments_.load(std::memory_order_relaxed);
+        snapshot.weak_increments = weak_increments_.load(std::memory_order_relaxed);
+        size_t blocks = blocks_.load(std::memory_order_relaxed);
+        snapshot.weak_only = blocks > snapshot.live ? blocks - snapshot.live : 0;
+        snapshot.unique_deletes = unique_deletes_.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+    static const TypeStats* First() {
+        return Head().load(std::memory_order_acquire);
+    }
+    const TypeStats* Next() const {
+        return next_;
+    }
+
+private:
+    template <typename T>
+    static std::string TypeName() {
+        const char* name = typeid(T).name();
+#if __has_include(<cxxabi.h>)
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if (status == 0 && demangled != nullptr) {
+            std::string result = demangled;
+            std::free(demangled);
+            return result;
+        }
+#endif
+        return name;
+    }
+
+    static std::atomic<TypeStats*>& Head() {
+        static std::atomic<TypeStats*> head{nullptr};
+        return head;
+    }
+
+    const std::string type_;
+    TypeStats* next_ = nullptr;
+    std::atomic<size_t> allocations_{0};
+    std::atomic<size_t> live_{0};
+    std::atomic<size_t> peak_live_{0};
+    std::atomic<size_t> blocks_{0};
+    std::atomic<size_t> strong_increments_{0};
+    std::atomic<size_t> weak_increments_{0};
+    std::atomic<size_t> unique_deletes_{0};
+};
+
+#ifdef SMART_PTRS_INSTRUMENTATION
+
+// What a control block stores: the statistics of its object type
+class StatsHandle {
+public:
+    StatsHandle() = default;
+
+    template <typename T>
+    static StatsHandle For() {
+        StatsHandle handle;
+        handle.stats_ = &TypeStats::For<T>();
+        return handle;
+    }
+
+    void OnCreate() const {
+        stats_->OnCreate();
+    }
+    void OnDestroyObject() const {
+        stats_->OnDestroyObject();
+    }
+    void OnFreeBlock() const {
+        if (stats_ != nullptr) {
+            stats_->OnFreeBlock();
+        }
+    }
+    void OnStrongIncrement(size_t count = 1) const {
+        stats_->OnStrongIncrement(count);
+    }
+    void OnWeakIncrement() const {
+        stats_->OnWeakIncrement();
+    }
+
+    template <typename T>
+    static void OnUniqueDelete() {
+        TypeStats::For<T>().OnUniqueDelete();
+    }
+
+private:
+    TypeStats* stats_ = nullptr;
+};
+
+#else
+
+class StatsHandle {
+public:
+    template <typename T>
+    static StatsHandle For() {
+        return {};
+    }
+
+    void OnCreate() const {
+    }
+    void OnDestroyObject() const {
+    }
+    void OnFreeBlock() const {
+    }
+    void OnStrongIncrement(size_t = 1) const {
+    }
+    void OnWeakIncrement() const {
+    }
+
+    template <typename T>
+    static void OnUniqueDelete() {
+    }
+};
+
+#endif
+
+// Counters of every type seen so far, empty without `SMART_PTRS_INSTRUMENTATION`
+inline std::vector<TypeStatsSnapshot> SnapshotStats() {
+    std::vector<TypeStatsSnapshot> result;
+    for (const TypeStats* stats = TypeStats::First(); stats != nullptr; stats = stats->Next()) {
+        result.push_back(stats->Snapshot());
+    }
+    return result;
+}
+
+// One line per type
+inline void DumpStats(std::ostream& out) {
+    if constexpr (!kInstrumentation) {
+        out << "smart pointer instrumentation is disabled, build with "
+               "-DSMART_PTRS_INSTRUMENTATION\n";
+        return;
+    }
+    for (const TypeStatsSnapshot& stats : SnapshotStats()) {
+        out << stats.type << ": allocations=" << stats.allocations << " live=" << stats.live
+            << " peak_live=" << stats.peak_live << " strong_increments=" << stats.strong_increments
+            << " weak_increments=" << stats.weak_increments << " weak_only=" << stats.weak_only
+            << " unique_deletes=" << stats.unique_deletes << '\n';
+    }
+}
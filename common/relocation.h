@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Trivial relocation: moving an object to a new address and ending the old one is the same as
+// copying its bytes and forgetting the source, without running the move constructor and the
+// destructor. Every type whose state is a few pointers with no pointer into itself qualifies,
+// the smart pointers of this project among them; they specialize `IsTriviallyRelocatable`.
+//
+// `RelocVector<T>` grows such types with one `memcpy` of the whole buffer, so reallocating a
+// vector of a million `SharedPtr`s touches no reference counter. Other types are moved element by
+// element, or copied if their move constructor may throw, like in `std::vector`.
+// The trait follows the proposals P1144 and P2786, which have no library support yet.
+
+template <typename T>
+struct IsTriviallyRelocatable : std::bool_constant<std::is_trivially_copyable_v<T>> {};
+
+// Trivial ABI build mode, enabled by compiling with `-DSMART_PTRS_TRIVIAL_ABI` (CMake:
+// `-DSMART_PTRS_TRIVIAL_ABI=ON`). Clang then treats `UniquePtr` with a trivially copyable deleter
+// as trivial for calls, and the callee destroys the argument. Where the platform ABI passes such
+// types in registers, as x86-64 System V does, the pointer no longer needs a stack slot; the
+// `codegen_trivial_abi` test checks that in the assembly for x86-64 Linux. Every translation unit
+// that passes the pointers across calls must agree on the flag. Other compilers ignore it.
+// https://clang.llvm.org/docs/AttributeReference.html#trivial-abi
+#if defined(SMART_PTRS_TRIVIAL_ABI) && defined(__clang__)
+#define SMART_PTRS_TRIVIAL_ABI_ATTRIBUTE [[clang::trivial_abi]]
+inline constexpr bool kTrivialAbi = true;
+#else
+#define SMART_PTRS_TRIVIAL_ABI_ATTRIBUTE
+inline constexpr bool kTrivialAbi = false;
+#endif
+
+template <typename T>
+inline constexpr bool kIsTriviallyRelocatable = IsTriviallyRelocatable<T>::value;
+
+// A minimal vector that relocates with `memcpy` where it can
+template <typename T>
+class RelocVector {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    RelocVector() = default;
+
+    RelocVector(const RelocVector& other) : data_(Allocate(other.size_)), capacity_(other.size_) {
+        try {
+            std::uninitialized_copy(other.begin(), other.end(), data_);
+        } catch (...) {
+            Deallocate(data_, capacity_);
+            throw;
+        }
+        size_ = other.size_;
+    }
+    RelocVector(RelocVector&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          capacity_(std::exchange(other.capacity_, 0)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // operator=-s
+
+    RelocVector& operator=(const RelocVector& other) {
+        RelocVector(other).Swap(*this);
+        return *this;
+    }
+    RelocVector& operator=(RelocVector&& other) noexcept {
+        RelocVector(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~RelocVector() {
+        Clear();
+        Deallocate(data_, capacity_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // `args` may refer to an element of the vector itself
+    template <typename... Args>
+    T& EmplaceBack(Args&&... args) {
+        if (size_ != capacity_) {
+            ::new (static_cast<void*>(data_ + size_)) T(std::forward<Args>(args)...);
+            return data_[size_++];
+        }
+        size_t capacity = NextCapacity(size_ + 1);
+        T* fresh = Allocate(capacity);
+        try {
+            ::new (static_cast<void*>(fresh + size_)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            Deallocate(fresh, capacity);
+            throw;
+        }
+        try {
+            Relocate(fresh);
+        } catch (...) {
+            fresh[size_].~T();
+            Deallocate(fresh, capacity);
+            throw;
+        }
+        Adopt(fresh, capacity);
+        return data_[size_++];
+    }
+    void PushBack(const T& value) {
+        EmplaceBack(value);
+    }
+    void PushBack(T&& value) {
+        EmplaceBack(std::move(value));
+    }
+    void PopBack() {
+        data_[--size_].~T();
+    }
+    void Clear() {
+        std::destroy(data_, data_ + size_);
+        size_ = 0;
+    }
+
+    void Reserve(size_t capacity) {
+        if (capacity > capacity_) {
+            Reallocate(capacity);
+        }
+    }
+    void ShrinkToFit() {
+        if (size_ != capacity_) {
+            Reallocate(size_);
+        }
+    }
+
+    void Swap(RelocVector& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t Size() const {
+        return size_;
+    }
+    size_t Capacity() const {
+        return capacity_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    T* Data() {
+        return data_;
+    }
+    const T* Data() const {
+        return data_;
+    }
+    T& operator[](size_t index) {
+        return data_[index];
+    }
+    const T& operator[](size_t index) const {
+        return data_[index];
+    }
+    T& Back() {
+        return data_[size_ - 1];
+    }
+    const T& Back() const {
+        return data_[size_ - 1];
+    }
+
+    T* begin() {
+        return data_;
+    }
+    T* end() {
+        return data_ + size_;
+    }
+    const T* begin() const {
+        return data_;
+    }
+    const T* end() const {
+        return data_ + size_;
+    }
+
+private:
+    static T* Allocate(size_t capacity) {
+        if (capacity == 0) {
+            return nullptr;
+        }
+        if (capacity > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t{alignof(T)}));
+    }
+    static void Deallocate(T* data, size_t capacity) {
+        if (data != nullptr) {
+            ::operator delete(static_cast<void*>(data), capacity * sizeof(T),
+                              std::align_val_t{alignof(T)});
+        }
+    }
+
+    size_t NextCapacity(size_t required) const {
+        return std::max(required, capacity_ * 2);
+    }
+
+    // Moves the elements to `to` and ends them here. Leaves them in place if a copy throws.
+    void Relocate(T* to) {
+        if constexpr (kIsTriviallyRelocatable<T>) {
+            if (size_ != 0) {
+                std::memcpy(static_cast<void*>(to), static_cast<const void*>(data_),
+                            size_ * sizeof(T));
+            }
+        } else {
+            if constexpr (std::is_nothrow_move_constructible_v<T> ||
+                          !std::is_copy_constructible_v<T>) {
+                std::uninitialized_move(data_, data_ + size_, to);
+            } else {
+                std::uninitialized_copy(data_, data_ + size_, to);
+            }
+            std::destroy(data_, data_ + size_);
+        }
+    }
+
+    void Reallocate(size_t capacity) {
+        T* fresh = Allocate(capacity);
+        try {
+            Relocate(fresh);
+        } catch (...) {
+            Deallocate(fresh, capacity);
+            throw;
+        }
+        Adopt(fresh, capacity);
+    }
+
+    // Takes over relocated storage
+    void Adopt(T* fresh, size_t capacity) {
+        Deallocate(data_, capacity_);
+        data_ = fresh;
+        capacity_ = capacity;
+    }
+
+    T* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "shared.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Arena mode for request-scoped objects: `MakeShared<T>(arena, args...)` places the control block
+// and the object in a `MonotonicArena`. Reference counting still runs the destructor when the last
+// `SharedPtr` goes, but the memory is only reclaimed, all at once, by `arena.Reset()` or the
+// arena's destructor.
+//
+// `MakeSharedUncounted<T>(arena, args...)` goes one step further for trivially destructible
+// types: there is no control block at all, copies do not count and `UseCount()` is 0. Such a
+// pointer cannot be observed by a `WeakPtr`, and is valid exactly as long as the arena memory.
+//
+// The arena itself is not thread safe. Every pointer into it, weak ones included, must be gone
+// before `Reset()`.
+//
+// Usage:
+//     MonotonicArena arena;
+//     auto request = MakeShared<Request>(arena, ...);
+//     ...
+//     request.Reset();
+//     arena.Reset();
+class MonotonicArena {
+public:
+    static constexpr size_t kDefaultChunkSize = size_t{64} << 10;
+
+    explicit MonotonicArena(size_t chunk_size = kDefaultChunkSize) : chunk_size_(chunk_size) {
+    }
+
+    MonotonicArena(const MonotonicArena&) = delete;
+    MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+    ~MonotonicArena() {
+        FreeChunks(nullptr);
+    }
+
+    // Bump allocation, `alignment` is a power of two
+    void* Allocate(size_t size, size_t alignment) {
+        size_t padding = Padding(alignment);
+        if (size > Left() || padding > Left() - size) {
+            NewChunk(size, alignment);
+            padding = Padding(alignment);
+        }
+        void* result = current_ + padding;
+        current_ += padding + size;
+        bytes_allocated_ += size;
+        return result;
+    }
+
+    // Reclaims everything allocated so far, keeping the first chunk for reuse
+    void Reset() {
+        Chunk* first = chunks_;
+        while (first != nullptr && first->next != nullptr) {
+            first = first->next;
+        }
+        if (first != nullptr && first->size != chunk_size_) {
+            first = nullptr;
+        }
+        FreeChunks(first);
+        chunks_ = first;
+        current_ = first != nullptr ? first->Data() : nullptr;
+        end_ = first != nullptr ? first->Data() + first->size : nullptr;
+        bytes_allocated_ = 0;
+    }
+
+    // Bytes handed out since the last `Reset()`
+    size_t BytesAllocated() const {
+        return bytes_allocated_;
+    }
+
+private:
+    struct alignas(std::max_align_t) Chunk {
+        Chunk* next;
+        size_t size;
+
+        std::byte* Data() {
+            return reinterpret_cast<std::byte*>(this + 1);
+        }
+    };
+
+    size_t Padding(size_t alignment) const {
+        return static_cast<size_t>(-reinterpret_cast<uintptr_t>(current_)) & (alignment - 1);
+    }
+    size_t Left() const {
+        return static_cast<size_t>(end_ - current_);
+    }
+
+    void NewChunk(size_t size, size_t alignment) {
+        if (size > SIZE_MAX - sizeof(Chunk) - alignment) {
+            throw std::bad_alloc();
+        }
+        // Oversized requests get a chunk of their own
+        size_t capacity = std::max(chunk_size_, size + alignment);
+        auto chunk = static_cast<Chunk*>(::operator new(sizeof(Chunk) + capacity));
+        chunk->next = chunks_;
+        chunk->size = capacity;
+        chunks_ = chunk;
+        current_ = chunk->Data();
+        end_ = current_ + capacity;
+    }
+
+    // Frees the chunks allocated after `keep`, all of them if it is nullptr
+    void FreeChunks(Chunk* keep) {
+        while (chunks_ != keep) {
+            Chunk* next = chunks_->next;
+            ::operator delete(static_cast<void*>(chunks_), sizeof(Chunk) + chunks_->size);
+            chunks_ = next;
+        }
+    }
+
+    size_t chunk_size_;
+    Chunk* chunks_ = nullptr;
+    std::byte* current_ = nullptr;
+    std::byte* end_ = nullptr;
+    size_t bytes_allocated_ = 0;
+};
+
+// Standard allocator over a `MonotonicArena`, `deallocate` does nothing
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    explicit ArenaAllocator(MonotonicArena& arena) noexcept : arena(&arena) {
+    }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) {
+    }
+
+    T* allocate(size_t n) {
+        if (n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) noexcept {
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const noexcept {
+        return arena == other.arena;
+    }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const noexcept {
+        return arena != other.arena;
+    }
+
+    MonotonicArena* arena;
+};
+
+// The block and the object in `arena`, see above
+template <typename T, typename Policy = DefaultLockPolicy, typename... Args>
+    requires(!std::is_array_v<T>)
+SharedPtr<T, Policy> MakeShared(MonotonicArena& arena, Args&&... args) {
+    return AllocateShared<T, Policy>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+}
+
+// The object alone in `arena`, without a control block
+template <typename T, typename Policy = DefaultLockPolicy, typename... Args>
+    requires(!std::is_array_v<T> && std::is_trivially_destructible_v<T>)
+SharedPtr<T, Policy> MakeSharedUncounted(MonotonicArena& arena, Args&&... args) {
+    T* ptr = ::new (arena.Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(nullptr, ptr);
+}
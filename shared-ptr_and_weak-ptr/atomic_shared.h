@@ -0,0 +1,185 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/atomic2
+//
+// Lock-free atomic `SharedPtr`, based on split reference counting (Williams, "C++ Concurrency in
+// Action", 7.2.4). The stored `SharedPtr` lives in a node owned by the atomic; the 64-bit word
+// packs the node address (low 48 bits) with a count of readers currently inside `Load` (high 16
+// bits). A reader takes its temporary reference with one `fetch_add` on the word, so a writer
+// swapping the word always learns how many readers may still touch the old node.
+//
+// Each node is installed once and swapped out once. Readers that find their node swapped out
+// decrement the node's own signed counter, which may go below zero; the writer that swapped it
+// out first takes what it needs from the node and then adds the number of readers it found.
+// Whichever side brings the counter to zero frees the node, so no node is freed while a reader
+// is about to copy the `SharedPtr` out of it or before the writer is done with it.
+template <typename T, typename Policy = AtomicPolicy>
+class AtomicSharedPtr {
+    static_assert(!std::is_same_v<Policy, SingleThreadedPolicy>,
+                  "AtomicSharedPtr needs a thread-safe locking policy");
+    static_assert(sizeof(void*) == 8, "AtomicSharedPtr packs pointers into 48 bits");
+
+    struct Node {
+        SharedPtr<T, Policy> value;
+        // Readers handed over by the writer minus readers that left, see above
+        std::atomic<int64_t> refs{0};
+
+        explicit Node(SharedPtr<T, Policy>&& v) : value(std::move(v)) {
+        }
+    };
+
+    static constexpr int kCountShift = 48;
+    static constexpr uint64_t kOneReader = uint64_t{1} << kCountShift;
+    static constexpr uint64_t kPointerMask = kOneReader - 1;
+
+    mutable std::atomic<uint64_t> word_{0};
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    AtomicSharedPtr() = default;
+    AtomicSharedPtr(SharedPtr<T, Policy> desired) : word_(Pack(MakeNode(std::move(desired)))) {
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    // No other thread may use the atomic any more, so no reader holds the node
+    ~AtomicSharedPtr() {
+        delete Unpack(word_.load(std::memory_order_acquire));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Atomic operations
+
+    SharedPtr<T, Policy> Load() const {
+        if (Unpack(word_.load(std::memory_order_relaxed)) == nullptr) {
+            return SharedPtr<T, Policy>();
+        }
+        Node* node = Pin();
+        SharedPtr<T, Policy> result;
+        if (node != nullptr) {
+            result = node->value;
+        }
+        Unpin(node);
+        return result;
+    }
+
+    void Store(SharedPtr<T, Policy> desired) {
+        Exchange(std::move(desired));
+    }
+
+    SharedPtr<T, Policy> Exchange(SharedPtr<T, Policy> desired) {
+        Node* fresh = MakeNode(std::move(desired));
+        uint64_t old = word_.exchange(Pack(fresh), std::memory_order_acq_rel);
+        Node* node = Unpack(old);
+        if (node == nullptr) {
+            return SharedPtr<T, Policy>();
+        }
+        int64_t readers = static_cast<int64_t>(old >> kCountShift);
+        if (readers == 0) {
+            // No reader ever pinned the node while it was installed, nobody else can reach it
+            SharedPtr<T, Policy> result = std::move(node->value);
+            delete node;
+            return result;
+        }
+        // Copied before the hand-over: from then on the readers may free the node
+        SharedPtr<T, Policy> result = node->value;
+        Release(node, readers);
+        return result;
+    }
+
+    // Replaces the value with `desired` if it holds the same pointer and control block as
+    // `expected`, otherwise loads the current value into `expected`.
+    bool CompareExchange(SharedPtr<T, Policy>& expected, SharedPtr<T, Policy> desired) {
+        Node* fresh = nullptr;
+        bool has_fresh = false;
+        while (true) {
+            Node* node = Pin();
+            bool equal = node != nullptr ? SameAs(node->value, expected) : IsEmpty(expected);
+            if (!equal) {
+                expected = node != nullptr ? node->value : SharedPtr<T, Policy>();
+                Unpin(node);
+                delete fresh;
+                return false;
+            }
+            if (!has_fresh) {
+                fresh = MakeNode(std::move(desired));
+                has_fresh = true;
+            }
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            while (Unpack(word) == node) {
+                if (word_.compare_exchange_weak(word, Pack(fresh), std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    if (node != nullptr) {
+                        // Our own pin is among the readers and leaves right away
+                        Release(node, static_cast<int64_t>(word >> kCountShift) - 1);
+                    }
+                    return true;
+                }
+            }
+            // Replaced between the pin and the swap, compare again
+            Unpin(node);
+        }
+    }
+
+    bool IsLockFree() const {
+        return word_.is_lock_free();
+    }
+
+private:
+    static uint64_t Pack(Node* node) {
+        return reinterpret_cast<uintptr_t>(node);
+    }
+    static Node* Unpack(uint64_t word) {
+        return reinterpret_cast<Node*>(static_cast<uintptr_t>(word & kPointerMask));
+    }
+
+    static bool IsEmpty(const SharedPtr<T, Policy>& ptr) {
+        return ptr.Get() == nullptr && ptr.GetBlock() == nullptr;
+    }
+    static bool SameAs(const SharedPtr<T, Policy>& left, const SharedPtr<T, Policy>& right) {
+        return left.Get() == right.Get() && left.GetBlock() == right.GetBlock();
+    }
+    static Node* MakeNode(SharedPtr<T, Policy>&& value) {
+        return IsEmpty(value) ? nullptr : new Node(std::move(value));
+    }
+
+    // Takes a temporary reference on the installed node, which stays valid until `Unpin`
+    Node* Pin() const {
+        return Unpack(word_.fetch_add(kOneReader, std::memory_order_acquire));
+    }
+    void Unpin(Node* node) const {
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        while (Unpack(word) == node) {
+            if (word_.compare_exchange_weak(word, word - kOneReader, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        // A writer swapped the node out, our pin now counts against the node
+        if (node != nullptr) {
+            Release(node, -1);
+        }
+    }
+
+    // Adds `delta` to the node counter: the writer's hand-over of the readers it found, or -1
+    // for one reader leaving. Frees the node if that balances the two.
+    static void Release(Node* node, int64_t delta) {
+        if (node->refs.fetch_add(delta, std::memory_order_acq_rel) + delta == 0) {
+            delete node;
+        }
+    }
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include "sw_fwd.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Biased reference counting, see Choi, Shull, Torrellas, "Biased Reference Counting" (PACT'18).
+// The thread that creates a block owns a counter it updates with plain loads and stores, every
+// other thread goes through an atomic shared counter. When the owner drops its last reference
+// the two are merged and from then on all threads use the shared counter only.
+//
+// A reference counted by the owner may still be released on another thread. Instead of driving
+// the shared count negative, the releasing thread then hands its reference to the owner through
+// a per-thread queue, which the owner drains on its next release or in `DrainBiasedQueue()`.
+// Until then the object stays alive. Once the owner thread has exited, the releasing thread
+// merges by itself.
+//
+// Usage: `MakeShared<T, BiasedPolicy>(...)`, `SharedPtr<T, BiasedPolicy>`.
+struct BiasedPolicy {};
+
+class BiasedThreadRecord;
+
+template <>
+struct ControlBlock<BiasedPolicy> : PoolAllocated {
+    // `shared` stores `count << 2 | queued << 1 | merged`
+    static constexpr ptrdiff_t kMerged = 1;
+    static constexpr ptrdiff_t kQueued = 2;
+    static constexpr ptrdiff_t kOne = 4;
+
+    const ControlBlockOps<BiasedPolicy>* ops;
+    // Cleared on merge
+    std::atomic<BiasedThreadRecord*> owner;
+    // Written by the owner only, relaxed load + store keeps it a plain `mov`
+    std::atomic<size_t> local;
+    std::atomic<ptrdiff_t> shared;
+    std::atomic<size_t> weak_counter{1};
+    ControlBlock* next_queued = nullptr;
+    [[no_unique_address]] StatsHandle stats;
+
+    explicit ControlBlock(const ControlBlockOps<BiasedPolicy>* block_ops);
+
+    template <typename T>
+    void Instrument() {
+        stats = StatsHandle::For<T>();
+        stats.OnCreate();
+    }
+
+    void PlusCounter(size_t count = 1);
+    bool TryPlusCounter();
+    void PlusWeakCounter() {
+        stats.OnWeakIncrement();
+        weak_counter.fetch_add(1, std::memory_order_relaxed);
+    }
+    void MinusCounter();
+    size_t GetCounter();
+    void MinusWeakCounter() {
+        if (weak_counter.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            ops->free_block(this);
+        }
+    }
+
+private:
+    friend class BiasedThreadRecord;
+
+    static ptrdiff_t Count(ptrdiff_t shared) {
+        return (shared - (shared & (kMerged | kQueued))) / kOne;
+    }
+
+    bool IsOwner() const;
+    void Merge();
+    bool RequestMerge(ptrdiff_t& value);
+    void ProcessQueued(BiasedThreadRecord* record);
+    void ReleaseObject() {
+        stats.OnDestroyObject();
+        ops->destroy_object(this);
+        MinusWeakCounter();
+    }
+
+protected:
+    ~ControlBlock() {
+        stats.OnFreeBlock();
+    }
+};
+
+// Owner side of biased blocks. One per thread, alive until the thread exits and every block
+// biased to it has merged.
+class BiasedThreadRecord {
+public:
+    using Block = ControlBlock<BiasedPolicy>;
+
+    // nullptr once the thread has started exiting, blocks created then are not biased
+    static BiasedThreadRecord* Current() {
+        if (current_ == nullptr && !exiting_) {
+            current_ = new BiasedThreadRecord();
+            exit_.Arm();
+        }
+        return current_;
+    }
+    static BiasedThreadRecord* Peek() {
+        return current_;
+    }
+
+    void Acquire() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    bool HasQueued() const {
+        return queue_.load(std::memory_order_relaxed) != nullptr;
+    }
+    // Returns false if the owner has exited
+    bool Push(Block* block) {
+        // Acquire, so that seeing the queue closed also shows the owner's final `local`
+        Block* head = queue_.load(std::memory_order_acquire);
+        do {
+            if (head == Closed()) {
+                return false;
+            }
+            block->next_queued = head;
+        } while (!queue_.compare_exchange_weak(head, block, std::memory_order_release,
+                                               std::memory_order_acquire));
+        return true;
+    }
+    void Drain() {
+        Process(queue_.exchange(nullptr, std::memory_order_acquire));
+    }
+
+private:
+    struct ThreadExit {
+        void Arm() {
+        }
+        ~ThreadExit() {
+            BiasedThreadRecord* record = current_;
+            exiting_ = true;
+            if (record == nullptr) {
+                return;
+            }
+            // Stop being the owner before closing the queue, so that whoever finds it closed
+            // reads the final value of `local`.
+            current_ = nullptr;
+            record->Process(record->queue_.exchange(Closed(), std::memory_order_acq_rel));
+            record->Release();
+        }
+    };
+
+    static Block* Closed() {
+        return reinterpret_cast<Block*>(uintptr_t{1});
+    }
+
+    void Process(Block* head) {
+        while (head != nullptr) {
+            Block* next = head->next_queued;
+            head->ProcessQueued(this);
+            head = next;
+        }
+    }
+
+    // The thread itself plus every unmerged block biased to it
+    std::atomic<size_t> refs_{1};
+    std::atomic<Block*> queue_{nullptr};
+
+    static inline thread_local BiasedThreadRecord* current_ = nullptr;
+    static inline thread_local bool exiting_ = false;
+    static inline thread_local ThreadExit exit_;
+};
+
+// Merges the blocks other threads have queued for the calling thread. Releases do it
+// automatically, call this from threads that may stay idle for long.
+inline void DrainBiasedQueue() {
+    if (BiasedThreadRecord* record = BiasedThreadRecord::Peek()) {
+        record->Drain();
+    }
+}
+
+inline ControlBlock<BiasedPolicy>::ControlBlock(const ControlBlockOps<BiasedPolicy>* block_ops)
+    : ops(block_ops) {
+    BiasedThreadRecord* record = BiasedThreadRecord::Current();
+    if (record != nullptr) {
+        record->Acquire();
+        owner.store(record, std::memory_order_relaxed);
+        local.store(1, std::memory_order_relaxed);
+        shared.store(0, std::memory_order_relaxed);
+    } else {
+        owner.store(nullptr, std::memory_order_relaxed);
+        local.store(0, std::memory_order_relaxed);
+        shared.store(kOne | kMerged, std::memory_order_relaxed);
+    }
+}
+
+inline bool ControlBlock<BiasedPolicy>::IsOwner() const {
+    BiasedThreadRecord* record = owner.load(std::memory_order_relaxed);
+    return record != nullptr && record == BiasedThreadRecord::Peek();
+}
+
+inline void ControlBlock<BiasedPolicy>::PlusCounter(size_t count) {
+    stats.OnStrongIncrement(count);
+    if (IsOwner()) {
+        local.store(local.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    } else {
+        shared.fetch_add(static_cast<ptrdiff_t>(count) * kOne, std::memory_order_relaxed);
+    }
+}
+
+// Until the merge the owner still holds a reference, so only a merged zero has to fail
+inline bool ControlBlock<BiasedPolicy>::TryPlusCounter() {
+    if (IsOwner()) {
+        PlusCounter();
+        return true;
+    }
+    ptrdiff_t value = shared.load(std::memory_order_relaxed);
+    do {
+        if ((value & kMerged) != 0 && Count(value) == 0) {
+            return false;
+        }
+    } while (!shared.compare_exchange_weak(value, value + kOne, std::memory_order_acq_rel,
+                                           std::memory_order_relaxed));
+    stats.OnStrongIncrement();
+    return true;
+}
+
+inline void ControlBlock<BiasedPolicy>::MinusCounter() {
+    if (IsOwner()) {
+        BiasedThreadRecord* record = owner.load(std::memory_order_relaxed);
+        if (record->HasQueued()) {
+            record->Drain();
+        }
+        if (!IsOwner()) {
+            // Merged while draining
+            MinusCounter();
+            return;
+        }
+        size_t count = local.load(std::memory_order_relaxed) - 1;
+        local.store(count, std::memory_order_relaxed);
+        if (count == 0) {
+            Merge();
+        }
+        return;
+    }
+    ptrdiff_t value = shared.load(std::memory_order_relaxed);
+    do {
+        if ((value & (kMerged | kQueued)) == 0 && Count(value) <= 0 && RequestMerge(value)) {
+            return;
+        }
+    } while (!shared.compare_exchange_weak(value, value - kOne, std::memory_order_acq_rel,
+                                           std::memory_order_relaxed));
+    value -= kOne;
+    if ((value & kMerged) != 0 && Count(value) == 0) {
+        ReleaseObject();
+    }
+}
+
+inline size_t ControlBlock<BiasedPolicy>::GetCounter() {
+    ptrdiff_t value = shared.load(std::memory_order_relaxed);
+    ptrdiff_t count = Count(value);
+    if ((value & kMerged) == 0) {
+        count += local.load(std::memory_order_relaxed);
+    }
+    return count > 0 ? count : 0;
+}
+
+// Folds `local` into `shared`. Runs on the owner thread, or on the one thread handling a queued
+// request once the owner has exited.
+inline void ControlBlock<BiasedPolicy>::Merge() {
+    BiasedThreadRecord* record = owner.load(std::memory_order_relaxed);
+    auto count = static_cast<ptrdiff_t>(local.load(std::memory_order_relaxed));
+    ptrdiff_t delta = count * kOne + kMerged;
+    local.store(0, std::memory_order_relaxed);
+    ptrdiff_t value = shared.fetch_add(delta, std::memory_order_acq_rel) + delta;
+    // Only after `merged` is visible, see `RequestMerge`
+    owner.store(nullptr, std::memory_order_relaxed);
+    if ((value & kQueued) == 0) {
+        // Otherwise the queue entry still points at the record
+        record->Release();
+    }
+    if (Count(value) == 0) {
+        ReleaseObject();
+    }
+}
+
+// Called instead of a decrement that would take the shared count below zero before the merge.
+// On success our reference is handed over to the owner's queue, otherwise `value` is reloaded.
+inline bool ControlBlock<BiasedPolicy>::RequestMerge(ptrdiff_t& value) {
+    // Read before flagging: `owner` is cleared only after `merged` is set, so a non-null record
+    // read here stays alive for as long as the flag we set keeps the block unmerged.
+    BiasedThreadRecord* record = owner.load(std::memory_order_relaxed);
+    if (record == nullptr) {
+        value = shared.load(std::memory_order_relaxed);
+        return false;
+    }
+    if (!shared.compare_exchange_weak(value, value | kQueued, std::memory_order_acq_rel,
+                                      std::memory_order_relaxed)) {
+        return false;
+    }
+    if (!record->Push(this)) {
+        ProcessQueued(record);
+    }
+    return true;
+}
+
+// Runs on the owner thread, or on the releasing thread once the owner has exited. Drops the
+// reference the queue entry was holding.
+inline void ControlBlock<BiasedPolicy>::ProcessQueued(BiasedThreadRecord* record) {
+    if ((shared.load(std::memory_order_acquire) & kMerged) == 0) {
+        Merge();
+    }
+    record->Release();
+    if (shared.fetch_sub(kOne, std::memory_order_acq_rel) == kOne + kMerged + kQueued) {
+        ReleaseObject();
+    }
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <type_traits>
+#include <utility>
+
+// `CompactSharedPtr<T>` is a `SharedPtr<T>` squeezed into one pointer: it stores the control
+// block only and finds the object at its fixed place inside the block, so containers of shared
+// pointers take half the memory.
+//
+// That place is only fixed for objects created by `MakeShared` in one allocation with the block
+// (`ControlBlockAllocator<T>`), and only if the pointer still refers to that very object:
+//   * `MakeCompactShared<T>(...)` always creates such an object, whatever its size;
+//   * a `SharedPtr` converts if it came from `MakeShared<T>` of at most `kMakeSharedInlineLimit`
+//     bytes and was neither aliased nor converted from a `SharedPtr` to a derived class,
+//     otherwise the conversion throws `BadCompactPtr`;
+//   * the way back to `SharedPtr` always works.
+//
+// Usage:
+//     std::vector<CompactSharedPtr<Node>> nodes;
+//     nodes.push_back(MakeCompactShared<Node>(...));
+//     SharedPtr<Node> full = nodes.back();
+
+class BadCompactPtr : public std::exception {};
+
+template <typename T, typename Policy = DefaultLockPolicy>
+class CompactSharedPtr {
+    static_assert(!std::is_array_v<T>, "Arrays are not supported");
+
+    using Block = ControlBlockAllocator<std::remove_cv_t<T>, Policy>;
+
+    ControlBlock<Policy>* block_ = nullptr;
+
+    // False for a pointer without a block, such as an aliasing one with an empty owner
+    static bool Convertible(const SharedPtr<T, Policy>& other) {
+        auto block = other.GetBlock();
+        return block != nullptr && block->ops == &kControlBlockOps<Block, Policy> &&
+               static_cast<Block*>(block)->GetPtr() == other.Get();
+    }
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    CompactSharedPtr() = default;
+    CompactSharedPtr(std::nullptr_t) {
+    }
+
+    CompactSharedPtr(const CompactSharedPtr& other) : block_(other.block_) {
+        if (block_ != nullptr) {
+            block_->PlusCounter();
+        }
+    }
+    CompactSharedPtr(CompactSharedPtr&& other) noexcept
+        : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    // From the full representation, throws `BadCompactPtr` if the object is not at its place in
+    // a block, also when there is no block at all. A null pointer converts to an empty one.
+    explicit CompactSharedPtr(const SharedPtr<T, Policy>& other) {
+        if (other.Get() == nullptr) {
+            return;
+        }
+        if (!Convertible(other)) {
+            throw BadCompactPtr();
+        }
+        block_ = other.GetBlock();
+        block_->PlusCounter();
+    }
+    explicit CompactSharedPtr(SharedPtr<T, Policy>&& other) {
+        if (other.Get() == nullptr) {
+            return;
+        }
+        if (!Convertible(other)) {
+            throw BadCompactPtr();
+        }
+        block_ = std::exchange(other.block_, nullptr);
+        other.ptr_ = nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // operator=-s
+
+    CompactSharedPtr& operator=(const CompactSharedPtr& other) {
+        CompactSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    CompactSharedPtr& operator=(CompactSharedPtr&& other) noexcept {
+        CompactSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~CompactSharedPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Conversion to SharedPtr
+
+    operator SharedPtr<T, Policy>() const& {
+        SharedPtr<T, Policy> result;
+        if (block_ != nullptr) {
+            block_->PlusCounter();
+            result.block_ = block_;
+            result.ptr_ = Get();
+        }
+        return result;
+    }
+    operator SharedPtr<T, Policy>() && {
+        SharedPtr<T, Policy> result;
+        result.ptr_ = Get();
+        result.block_ = std::exchange(block_, nullptr);
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (ControlBlock<Policy>* block = std::exchange(block_, nullptr); block != nullptr) {
+            block->MinusCounter();
+        }
+    }
+    void Swap(CompactSharedPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    ControlBlock<Policy>* GetBlock() const {
+        return block_;
+    }
+
+    // No load: the object sits at a constant offset from the block
+    T* Get() const {
+        return block_ != nullptr ? static_cast<Block*>(block_)->GetPtr() : nullptr;
+    }
+    T& operator*() const {
+        return *static_cast<Block*>(block_)->GetPtr();
+    }
+    T* operator->() const {
+        return static_cast<Block*>(block_)->GetPtr();
+    }
+    size_t UseCount() const {
+        return block_ != nullptr ? block_->GetCounter() : 0;
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+};
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<CompactSharedPtr<T, Policy>> : std::true_type {};
+
+template <typename T, typename U, typename Policy>
+inline bool operator==(const CompactSharedPtr<T, Policy>& left,
+                       const CompactSharedPtr<U, Policy>& right) {
+    return left.Get() == right.Get();
+}
+
+// `MakeShared` that keeps the object inline for every size, so the result is always compact
+template <typename T, typename Policy = DefaultLockPolicy, typename... Args>
+    requires(!std::is_array_v<T>)
+CompactSharedPtr<T, Policy> MakeCompactShared(Args&&... args) {
+    static_assert(kInlineSharedFromThisMatches<T, Policy>,
+                  "EnableSharedFromThisInline<T, Policy> must name this very class and policy");
+    auto block = new ControlBlockAllocator<T, Policy>(std::forward<Args>(args)...);
+    // Sets up `SharedFromThis`, then hands the reference over
+    return CompactSharedPtr<T, Policy>(SharedPtr<T, Policy>(block, block->GetPtr()));
+}
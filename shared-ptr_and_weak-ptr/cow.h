@@ -0,0 +1,148 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+struct BiasedPolicy;
+
+// Copy-on-write value: `CowPtr<T>` behaves like a `T` passed by value, but a copy only takes a
+// reference to the same object. The object is cloned when somebody writes to it while other
+// `CowPtr`s still share it, so copies that are only read never pay for a deep copy.
+//
+// Reads go through `operator*`, `operator->` and `Read()`. Writes go through
+//   * `Write()`, which makes the object unique and returns a reference to it; the reference is
+//     only good until this `CowPtr` is copied again,
+//   * `Mutate(fn)`, which makes the object unique once and runs `fn(T&)`, so a batch of writes
+//     costs at most one clone.
+//
+// With `AtomicPolicy` copies of one value may be read, written and destroyed on different
+// threads, each `CowPtr` object itself by one thread at a time. The object is written in place
+// only when the use count is 1, and no new sharer can appear then: every reference is held by a
+// `CowPtr`, and the only one left is ours. `BiasedPolicy` counts only approximately, so it is not
+// supported.
+//
+// Usage:
+//     CowPtr<Config> config = MakeCow<Config>(...);
+//     CowPtr<Config> copy = config;                 // no deep copy
+//     copy.Mutate([](Config& c) {                   // one clone for both writes
+//         c.threads = 8;
+//         c.name = "copy";
+//     });
+template <typename T, typename Policy = DefaultLockPolicy>
+class CowPtr {
+    static_assert(!std::is_array_v<T>, "Arrays are not supported");
+    static_assert(!std::is_same_v<Policy, BiasedPolicy>, "BiasedPolicy has no exact use count");
+
+    SharedPtr<T, Policy> ptr_;
+
+    explicit CowPtr(SharedPtr<T, Policy>&& ptr) : ptr_(std::move(ptr)) {
+    }
+
+    // Clones the object if it is shared. Leaves everything as it was if the copy throws.
+    void Detach() {
+        if (ptr_.UseCount() != 1) {
+            ptr_ = MakeShared<T, Policy>(std::as_const(*ptr_));
+        }
+    }
+
+    template <typename Z, typename P, typename... Args>
+    friend CowPtr<Z, P> MakeCow(Args&&... args);
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    // Empty, like a null `SharedPtr`
+    CowPtr() = default;
+    CowPtr(std::nullptr_t) {
+    }
+
+    explicit CowPtr(const T& value) : ptr_(MakeShared<T, Policy>(value)) {
+    }
+    explicit CowPtr(T&& value) : ptr_(MakeShared<T, Policy>(std::move(value))) {
+    }
+
+    CowPtr(const CowPtr& other) = default;
+    CowPtr(CowPtr&& other) noexcept = default;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // operator=-s
+
+    CowPtr& operator=(const CowPtr& other) {
+        CowPtr(other).Swap(*this);
+        return *this;
+    }
+    CowPtr& operator=(CowPtr&& other) noexcept {
+        CowPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // The object, made unique first. Must not be empty.
+    T& Write() {
+        Detach();
+        return *ptr_;
+    }
+
+    // Runs `fn` on the object made unique once and returns what it returns. Must not be empty.
+    template <typename F>
+    decltype(auto) Mutate(F&& fn) {
+        Detach();
+        return std::invoke(std::forward<F>(fn), *ptr_);
+    }
+
+    void Reset() {
+        ptr_.Reset();
+    }
+    void Swap(CowPtr& other) noexcept {
+        ptr_.Swap(other.ptr_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const T& Read() const {
+        return *ptr_;
+    }
+    const T& operator*() const {
+        return *ptr_;
+    }
+    const T* operator->() const {
+        return ptr_.Get();
+    }
+    const T* Get() const {
+        return ptr_.Get();
+    }
+
+    // True if a write would not clone
+    bool Unique() const {
+        return ptr_.UseCount() == 1;
+    }
+    size_t UseCount() const {
+        return ptr_.UseCount();
+    }
+    explicit operator bool() const {
+        return static_cast<bool>(ptr_);
+    }
+};
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<CowPtr<T, Policy>> : std::true_type {};
+
+// Identity, not value, comparison: true if both share one object
+template <typename T, typename Policy>
+inline bool operator==(const CowPtr<T, Policy>& left, const CowPtr<T, Policy>& right) {
+    return left.Get() == right.Get();
+}
+
+// Constructs the object in place
+template <typename T, typename Policy = DefaultLockPolicy, typename... Args>
+CowPtr<T, Policy> MakeCow(Args&&... args) {
+    return CowPtr<T, Policy>(MakeShared<T, Policy>(std::forward<Args>(args)...));
+}
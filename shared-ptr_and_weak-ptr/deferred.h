@@ -0,0 +1,143 @@
+#pragma once
+
+#include "policy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Deferred destruction. With `SharedPtr<T, DeferredPolicy<>>` the thread that drops the last
+// strong reference only pushes the control block onto a global lock-free queue; the object is
+// destroyed later by `DrainDeferred()` or by a `DeferredReclaimer` thread.
+//
+// Destroying an object releases the pointers it holds, and their final releases are queued as
+// well instead of recursing, so a long chain is torn down one link at a time with constant stack
+// depth. Until it is reclaimed a queued object counts as expired for every `WeakPtr`.
+//
+// Objects still queued when the program exits are leaked unless somebody drains the queue.
+
+// Wraps a locking policy. Reclamation usually happens on another thread, so the default base is
+// `AtomicPolicy`; `DeferredPolicy<SingleThreadedPolicy>` only fits a thread that drains its own
+// queue with `DrainDeferred()`.
+template <typename Base = AtomicPolicy>
+struct DeferredPolicy : Base {
+    static constexpr bool kDeferred = true;
+};
+
+template <typename Policy>
+concept DeferredDestruction = Policy::kDeferred;
+
+// Queue link of control blocks in deferred mode
+struct DeferredNode {
+    DeferredNode* next_deferred = nullptr;
+    // Destroys the object and drops the weak reference held by the strong ones, set by the block
+    void (*reclaim)(DeferredNode*) = nullptr;
+
+protected:
+    ~DeferredNode() = default;
+};
+
+// Base of control blocks that are not in deferred mode
+struct NotDeferred {};
+
+class DeferredQueue {
+public:
+    static void Push(DeferredNode* node) {
+        PushChain(node, node);
+    }
+
+    // Reclaims up to `budget` objects, including the ones queued while draining.
+    // Returns how many were reclaimed.
+    static size_t Drain(size_t budget) {
+        size_t done = 0;
+        while (done < budget) {
+            DeferredNode* node = head_.exchange(nullptr, std::memory_order_acquire);
+            if (node == nullptr) {
+                break;
+            }
+            for (; node != nullptr && done < budget; ++done) {
+                DeferredNode* next = node->next_deferred;
+                node->reclaim(node);
+                node = next;
+            }
+            if (node != nullptr) {
+                // Out of budget, put the rest back
+                DeferredNode* tail = node;
+                while (tail->next_deferred != nullptr) {
+                    tail = tail->next_deferred;
+                }
+                PushChain(node, tail);
+            }
+        }
+        return done;
+    }
+
+    static bool Empty() {
+        return head_.load(std::memory_order_relaxed) == nullptr;
+    }
+
+private:
+    static void PushChain(DeferredNode* first, DeferredNode* last) {
+        DeferredNode* head = head_.load(std::memory_order_relaxed);
+        do {
+            last->next_deferred = head;
+        } while (!head_.compare_exchange_weak(head, first, std::memory_order_release,
+                                              std::memory_order_relaxed));
+    }
+
+    static inline std::atomic<DeferredNode*> head_{nullptr};
+};
+
+// Destroys up to `budget` queued objects on the calling thread, returns how many it destroyed
+inline size_t DrainDeferred(size_t budget = SIZE_MAX) {
+    return DeferredQueue::Drain(budget);
+}
+
+// Background thread draining the deferred queue. It polls every `period` and keeps going without
+// sleeping while the queue yields full budgets. The destructor stops the thread and drains what
+// is left.
+class DeferredReclaimer {
+public:
+    explicit DeferredReclaimer(std::chrono::microseconds period = std::chrono::milliseconds(1),
+                               size_t budget = 1024)
+        : period_(period), budget_(std::max<size_t>(budget, 1)), thread_([this] { Run(); }) {
+    }
+
+    DeferredReclaimer(const DeferredReclaimer&) = delete;
+    DeferredReclaimer& operator=(const DeferredReclaimer&) = delete;
+
+    ~DeferredReclaimer() {
+        {
+            std::lock_guard guard(mutex_);
+            stop_ = true;
+        }
+        wakeup_.notify_one();
+        thread_.join();
+        DrainDeferred();
+    }
+
+private:
+    void Run() {
+        std::unique_lock lock(mutex_);
+        while (!stop_) {
+            lock.unlock();
+            bool more = DrainDeferred(budget_) == budget_;
+            lock.lock();
+            if (!more) {
+                wakeup_.wait_for(lock, period_, [this] { return stop_; });
+            }
+        }
+    }
+
+    const std::chrono::microseconds period_;
+    const size_t budget_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stop_ = false;
+    std::thread thread_;
+};
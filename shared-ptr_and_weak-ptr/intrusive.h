@@ -0,0 +1,366 @@
+#pragma once
+
+#include "../common/relocation.h"
+#include "sw_fwd.h"  // Locking policies
+
+#include <cstddef>  // std::nullptr_t
+#include <new>
+#include <utility>
+
+// Intrusive reference counting: `IntrusivePtr<T>` is a single pointer and the counters live with
+// the object instead of in a separate control block.
+//
+// `RefCounted::operator new` reserves a small header right in front of the object for the strong
+// and weak counters, so a count update touches the object's own cache line. The header outlives
+// the destructor for as long as weak handles refer to it, which is what makes `Lock()` safe.
+// The header is found by address, hence:
+//   * objects are created with `new` or `MakeIntrusive`, never on the stack or inside another
+//     object or container;
+//   * a class derived from a counted class keeps it as its first base, so that a handle to any of
+//     them points to the start of the allocation;
+//   * over-aligned classes are not supported.
+//
+// Usage:
+//     struct Node : RefCounted<Node> { IntrusivePtr<Node> next; };
+//     auto node = MakeIntrusive<Node>();
+
+template <typename T>
+class IntrusivePtr;
+
+template <typename T>
+class IntrusiveWeakPtr;
+
+template <typename Policy>
+struct RefCountHeader {
+    // Packed strong and weak counts. All strong references together hold one weak reference,
+    // released after the destructor.
+    typename Policy::Counts counts{PackedCounts::kWeak};
+
+    static constexpr size_t kSize = (sizeof(typename Policy::Counts) +
+                                     __STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1) /
+                                    __STDCPP_DEFAULT_NEW_ALIGNMENT__ *
+                                    __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    static RefCountHeader* Of(const void* object) {
+        auto bytes = static_cast<std::byte*>(const_cast<void*>(object));
+        return reinterpret_cast<RefCountHeader*>(bytes - kSize);
+    }
+
+    void AddRef() {
+        Policy::Add(counts, PackedCounts::kStrong);
+    }
+    bool TryAddRef() {
+        return Policy::AddStrongIfNonZero(counts);
+    }
+    // True if the object has to be destroyed. The only owner of an object nobody else refers to
+    // stores the new word instead of an atomic update.
+    bool Release() {
+        if (Policy::Load(counts) == PackedCounts::kSoleOwner) {
+            Policy::Store(counts, PackedCounts::kWeak);
+            return true;
+        }
+        return PackedCounts::Strong(Policy::Subtract(counts, PackedCounts::kStrong)) == 1;
+    }
+    size_t UseCount() const {
+        return PackedCounts::Strong(Policy::Load(counts));
+    }
+    void AddWeakRef() {
+        Policy::Add(counts, PackedCounts::kWeak);
+    }
+    void ReleaseWeak() {
+        if (PackedCounts::Weak(Policy::Subtract(counts, PackedCounts::kWeak)) == 1) {
+            this->~RefCountHeader();
+            ::operator delete(static_cast<void*>(this));
+        }
+    }
+};
+
+// Base of intrusively counted classes, `T` is the derived class itself.
+// A fresh object has no strong references: the first `IntrusivePtr` takes one.
+template <typename T, typename Policy = DefaultLockPolicy>
+class RefCounted {
+public:
+    using RefCountPolicy = Policy;
+
+    static void* operator new(size_t size) {
+        using Header = RefCountHeader<Policy>;
+        auto memory = static_cast<std::byte*>(::operator new(Header::kSize + size));
+        ::new (memory) Header();
+        return memory + Header::kSize;
+    }
+    // Runs after the destructor, the memory is kept while weak handles remain
+    static void operator delete(void* ptr) noexcept {
+        RefCountHeader<Policy>::Of(ptr)->ReleaseWeak();
+    }
+    static void* operator new(size_t size, std::align_val_t alignment) = delete;
+    static void* operator new[](size_t size) = delete;
+
+    // Same as `SharedFromThis`, but no weak reference has to be stored: any raw pointer to a
+    // counted object can be turned into an owning one. Not to be called from the constructor.
+    IntrusivePtr<T> IntrusiveFromThis() {
+        return IntrusivePtr<T>(static_cast<T*>(this));
+    }
+    IntrusivePtr<const T> IntrusiveFromThis() const {
+        return IntrusivePtr<const T>(static_cast<const T*>(this));
+    }
+
+    // Takes a weak reference only, so it may be called from the constructor and the destructor.
+    // The handle does not lock before the first `IntrusivePtr` is taken, nor once the destructor
+    // has started.
+    IntrusiveWeakPtr<T> WeakFromThis() {
+        RefCountHeader<Policy>::Of(this)->AddWeakRef();
+        return IntrusiveWeakPtr<T>(static_cast<T*>(this), IntrusiveWeakPtr<T>::kAdopt);
+    }
+    IntrusiveWeakPtr<const T> WeakFromThis() const {
+        RefCountHeader<Policy>::Of(this)->AddWeakRef();
+        return IntrusiveWeakPtr<const T>(static_cast<const T*>(this),
+                                         IntrusiveWeakPtr<const T>::kAdopt);
+    }
+
+protected:
+    RefCounted() = default;
+    // A copy is a new object with counters of its own
+    RefCounted(const RefCounted&) noexcept {
+    }
+    RefCounted& operator=(const RefCounted&) noexcept {
+        return *this;
+    }
+    ~RefCounted() = default;
+};
+
+template <typename T>
+class IntrusivePtr {
+    T* ptr_ = nullptr;
+
+    template <typename Z>
+    friend class IntrusivePtr;
+
+    template <typename Z>
+    friend class IntrusiveWeakPtr;
+
+    // `T` may be incomplete where `IntrusivePtr<T>` is declared, so the policy is looked up late
+    static auto Counts(const T* ptr) {
+        return RefCountHeader<typename T::RefCountPolicy>::Of(ptr);
+    }
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    IntrusivePtr() = default;
+    IntrusivePtr(std::nullptr_t) {
+    }
+    // Takes a new strong reference, so the same raw pointer may be wrapped any number of times
+    explicit IntrusivePtr(T* ptr) : ptr_(ptr) {
+        if (ptr_ != nullptr) {
+            Counts(ptr_)->AddRef();
+        }
+    }
+
+    IntrusivePtr(const IntrusivePtr& other) : IntrusivePtr(other.ptr_) {
+    }
+    template <typename Z>
+    IntrusivePtr(const IntrusivePtr<Z>& other) : IntrusivePtr(other.ptr_) {
+    }
+    IntrusivePtr(IntrusivePtr&& other) noexcept : ptr_(std::exchange(other.ptr_, nullptr)) {
+    }
+    template <typename Z>
+    IntrusivePtr(IntrusivePtr<Z>&& other) noexcept : ptr_(std::exchange(other.ptr_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // operator=-s
+
+    IntrusivePtr& operator=(const IntrusivePtr& other) {
+        IntrusivePtr(other).Swap(*this);
+        return *this;
+    }
+    template <typename Z>
+    IntrusivePtr& operator=(const IntrusivePtr<Z>& other) {
+        IntrusivePtr(other).Swap(*this);
+        return *this;
+    }
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
+        IntrusivePtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+    template <typename Z>
+    IntrusivePtr& operator=(IntrusivePtr<Z>&& other) noexcept {
+        IntrusivePtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~IntrusivePtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (T* ptr = std::exchange(ptr_, nullptr); ptr != nullptr && Counts(ptr)->Release()) {
+            delete ptr;
+        }
+    }
+    void Reset(T* ptr) {
+        IntrusivePtr(ptr).Swap(*this);
+    }
+    void Swap(IntrusivePtr& other) noexcept {
+        std::swap(ptr_, other.ptr_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return ptr_;
+    }
+    T& operator*() const {
+        return *ptr_;
+    }
+    T* operator->() const {
+        return ptr_;
+    }
+    size_t UseCount() const {
+        return ptr_ != nullptr ? Counts(ptr_)->UseCount() : 0;
+    }
+    explicit operator bool() const {
+        return ptr_ != nullptr;
+    }
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<IntrusivePtr<T>> : std::true_type {};
+
+template <typename T, typename U>
+inline bool operator==(const IntrusivePtr<T>& left, const IntrusivePtr<U>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeIntrusive(Args&&... args) {
+    return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+}
+
+// Weak handle to an intrusively counted object, one pointer as well. Same interface as `WeakPtr`.
+template <typename T>
+class IntrusiveWeakPtr {
+    T* ptr_ = nullptr;
+
+    template <typename Z>
+    friend class IntrusiveWeakPtr;
+
+    template <typename Z, typename Policy>
+    friend class RefCounted;
+
+    static auto Counts(const T* ptr) {
+        return RefCountHeader<typename T::RefCountPolicy>::Of(ptr);
+    }
+
+    enum AdoptTag { kAdopt };
+
+    // Adopts a weak reference the caller has already taken
+    IntrusiveWeakPtr(T* ptr, AdoptTag) : ptr_(ptr) {
+    }
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    IntrusiveWeakPtr() = default;
+
+    // Demote `IntrusivePtr`
+    template <typename Z>
+    IntrusiveWeakPtr(const IntrusivePtr<Z>& other) : ptr_(other.ptr_) {
+        if (ptr_ != nullptr) {
+            Counts(ptr_)->AddWeakRef();
+        }
+    }
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) : ptr_(other.ptr_) {
+        if (ptr_ != nullptr) {
+            Counts(ptr_)->AddWeakRef();
+        }
+    }
+    template <typename Z>
+    IntrusiveWeakPtr(const IntrusiveWeakPtr<Z>& other) : ptr_(other.ptr_) {
+        if (ptr_ != nullptr) {
+            Counts(ptr_)->AddWeakRef();
+        }
+    }
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other) noexcept : ptr_(std::exchange(other.ptr_, nullptr)) {
+    }
+    template <typename Z>
+    IntrusiveWeakPtr(IntrusiveWeakPtr<Z>&& other) noexcept
+        : ptr_(std::exchange(other.ptr_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // operator=-s
+
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        IntrusiveWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    template <typename Z>
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr<Z>& other) {
+        IntrusiveWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) noexcept {
+        IntrusiveWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+    template <typename Z>
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr<Z>&& other) noexcept {
+        IntrusiveWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~IntrusiveWeakPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (T* ptr = std::exchange(ptr_, nullptr)) {
+            Counts(ptr)->ReleaseWeak();
+        }
+    }
+    void Swap(IntrusiveWeakPtr& other) noexcept {
+        std::swap(ptr_, other.ptr_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const {
+        return ptr_ != nullptr ? Counts(ptr_)->UseCount() : 0;
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    // Never throws, returns an empty pointer if the object is gone
+    IntrusivePtr<T> Lock() const noexcept {
+        IntrusivePtr<T> result;
+        if (ptr_ != nullptr && Counts(ptr_)->TryAddRef()) {
+            result.ptr_ = ptr_;
+        }
+        return result;
+    }
+    // Borrowed pointer for a liveness check, see `WeakPtr::TryLock`
+    T* TryLock() const noexcept {
+        return Expired() ? nullptr : ptr_;
+    }
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<IntrusiveWeakPtr<T>> : std::true_type {};
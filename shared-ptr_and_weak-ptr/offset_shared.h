@@ -0,0 +1,700 @@
+#pragma once
+
+#include "sw_fwd.h"  // BadWeakPtr, PackedCounts, AtomicPolicy
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// Reference counting across processes. `OffsetSharedPtr<T>` and `OffsetWeakPtr<T>` work like
+// `SharedPtr<T, AtomicPolicy>` and `WeakPtr<T, AtomicPolicy>`, but the control block and the
+// object live in a shared-memory segment (`ShmSegment`) that several processes map, so a large
+// object is built once and read by every process without a copy. Whichever process drops the
+// last reference destroys the object and frees its memory in the segment.
+//
+// A segment may be mapped at a different address in every process, so nothing in it holds a raw
+// pointer: the pointers store self-relative offsets (`OffsetPtr`) and the segment keeps its own
+// allocator (`ShmHeap`) at its start. The counters are the lock-free atomic words of
+// `AtomicPolicy`, which are address-free and thus work between processes. The object type must
+// follow the same rules: plain data, arrays, `OffsetPtr`s and `OffsetSharedPtr`s, no raw pointers
+// or heap-owning members such as `std::string`, and no alignment above 16.
+//
+// Segments come from `memfd_create` (`ShmSegment::CreateAnonymous`), inherited by forked
+// children or passed as a file descriptor, or from a named POSIX shared-memory object
+// (`ShmSegment::Create` / `ShmSegment::Open`). A process hands an object to the others through
+// the segment's root slot, which holds a reference of its own:
+//     ShmSegment segment = ShmSegment::CreateAnonymous(1 << 30);
+//     segment.PublishRoot(MakeOffsetShared<Dataset>(segment, ...));
+//     if (fork() == 0) {
+//         OffsetSharedPtr<Dataset> dataset = segment.Root<Dataset>();   // zero-copy
+//         ...
+//     }
+//
+// `fork()` copies the parent's own `OffsetSharedPtr` objects without counting them, so a child
+// must take its references from the root slot and must not release the inherited ones: leave
+// them alone and end with `_exit()`. A process that dies holding references leaks them, one that
+// dies inside `ShmHeap` blocks the allocator.
+
+// Self-relative pointer: stores the distance from its own address to the target, so it stays
+// valid in a segment mapped at different addresses. Copying recomputes the distance.
+// See boost::interprocess::offset_ptr.
+template <typename T>
+class OffsetPtr {
+    // Never the distance to an object of `T`, which is at least 2-byte aligned like the pointer
+    static constexpr uintptr_t kNull = 1;
+
+    void Set(T* ptr) {
+        static_assert(alignof(T) > 1, "The null offset must not be a valid distance");
+        if (ptr == nullptr) {
+            offset_ = kNull;
+        } else {
+            offset_ = reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(this);
+        }
+    }
+
+    uintptr_t offset_ = kNull;
+
+public:
+    OffsetPtr() = default;
+    OffsetPtr(std::nullptr_t) {
+    }
+    OffsetPtr(T* ptr) {
+        Set(ptr);
+    }
+    OffsetPtr(const OffsetPtr& other) {
+        Set(other.Get());
+    }
+
+    OffsetPtr& operator=(const OffsetPtr& other) {
+        Set(other.Get());
+        return *this;
+    }
+    OffsetPtr& operator=(T* ptr) {
+        Set(ptr);
+        return *this;
+    }
+
+    T* Get() const {
+        return offset_ == kNull ? nullptr
+                                : reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(this) + offset_);
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    explicit operator bool() const {
+        return offset_ != kNull;
+    }
+};
+
+// First-fit allocator at the start of a segment, shared by every process that maps it. Free
+// chunks are kept sorted by offset and merged with their neighbours. A spin lock in the segment
+// serializes the processes; allocation is meant for a few large objects, not for hot paths.
+class ShmHeap {
+public:
+    // Alignment of every allocation
+    static constexpr size_t kAlignment = 16;
+
+    // Lays out an empty heap over a fresh segment of `size` bytes
+    static ShmHeap* Format(void* base, size_t size) {
+        if (size < HeaderSize() + kMinChunk) {
+            throw std::invalid_argument("ShmHeap: segment too small");
+        }
+        auto heap = ::new (base) ShmHeap;
+        heap->size_ = size;
+        Chunk* chunk = heap->At(HeaderSize());
+        chunk->size = (size - HeaderSize()) / kAlignment * kAlignment;
+        chunk->next = 0;
+        heap->free_head_ = HeaderSize();
+        heap->free_bytes_ = chunk->size;
+        return heap;
+    }
+
+    // The heap of a segment formatted by another process
+    static ShmHeap* Attach(void* base, size_t size) {
+        auto heap = std::launder(static_cast<ShmHeap*>(base));
+        if (size < HeaderSize() || heap->magic_ != kMagic || heap->size_ != size) {
+            throw std::runtime_error("ShmHeap: not a formatted segment");
+        }
+        return heap;
+    }
+
+    // nullptr if no free chunk is large enough
+    void* Allocate(size_t bytes) {
+        if (bytes > size_) {
+            return nullptr;
+        }
+        uint64_t need = std::max<uint64_t>(RoundUp(bytes + sizeof(Chunk)), kMinChunk);
+        LockGuard guard(lock_);
+        for (uint64_t* link = &free_head_; *link != 0; link = &At(*link)->next) {
+            Chunk* chunk = At(*link);
+            if (chunk->size < need) {
+                continue;
+            }
+            free_bytes_ -= need;
+            if (chunk->size - need >= kMinChunk) {
+                // Cut the allocation off the end, the front stays in the list
+                chunk->size -= need;
+                Chunk* taken = At(*link + chunk->size);
+                taken->size = need;
+                return taken->Data();
+            }
+            free_bytes_ -= chunk->size - need;
+            *link = chunk->next;
+            return chunk->Data();
+        }
+        return nullptr;
+    }
+
+    void Deallocate(void* ptr) {
+        Chunk* chunk = reinterpret_cast<Chunk*>(static_cast<std::byte*>(ptr) - sizeof(Chunk));
+        uint64_t offset = OffsetOf(chunk);
+        LockGuard guard(lock_);
+        free_bytes_ += chunk->size;
+        uint64_t prev = 0;
+        uint64_t next = free_head_;
+        while (next != 0 && next < offset) {
+            prev = next;
+            next = At(next)->next;
+        }
+        if (next != 0 && offset + chunk->size == next) {
+            chunk->size += At(next)->size;
+            next = At(next)->next;
+        }
+        chunk->next = next;
+        if (prev == 0) {
+            free_head_ = offset;
+        } else if (prev + At(prev)->size == offset) {
+            At(prev)->size += chunk->size;
+            At(prev)->next = chunk->next;
+        } else {
+            At(prev)->next = offset;
+        }
+    }
+
+    size_t FreeBytes() const {
+        LockGuard guard(lock_);
+        return free_bytes_;
+    }
+
+private:
+    friend class ShmSegment;
+
+    // Marks a formatted segment
+    static constexpr uint64_t kMagic = 0x5348'4d48'4541'5031;
+
+    struct Chunk {
+        // With this header, a multiple of `kAlignment`
+        uint64_t size;
+        // Offset of the next free chunk, 0 at the end; part of the data once allocated
+        uint64_t next;
+
+        void* Data() {
+            return reinterpret_cast<std::byte*>(this) + sizeof(Chunk);
+        }
+    };
+    static_assert(sizeof(Chunk) == kAlignment);
+
+    static constexpr uint64_t kMinChunk = 2 * kAlignment;
+
+    class LockGuard {
+    public:
+        explicit LockGuard(std::atomic<uint32_t>& lock) : lock_(lock) {
+            while (lock_.exchange(1, std::memory_order_acquire) != 0) {
+                std::this_thread::yield();
+            }
+        }
+        ~LockGuard() {
+            lock_.store(0, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<uint32_t>& lock_;
+    };
+
+    static constexpr uint64_t RoundUp(uint64_t bytes) {
+        return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+    }
+    static constexpr uint64_t HeaderSize();
+
+    Chunk* At(uint64_t offset) {
+        return reinterpret_cast<Chunk*>(reinterpret_cast<std::byte*>(this) + offset);
+    }
+    uint64_t OffsetOf(const void* ptr) const {
+        return static_cast<const std::byte*>(ptr) - reinterpret_cast<const std::byte*>(this);
+    }
+
+    uint64_t magic_ = kMagic;
+    uint64_t size_ = 0;
+    mutable std::atomic<uint32_t> lock_{0};
+    uint64_t free_head_ = 0;
+    uint64_t free_bytes_ = 0;
+    // Offset of the control block the root slot refers to, 0 if empty. Guarded by `lock_`.
+    uint64_t root_ = 0;
+};
+
+constexpr uint64_t ShmHeap::HeaderSize() {
+    return RoundUp(sizeof(ShmHeap));
+}
+
+// Control block and object in one chunk of the segment
+template <typename T>
+struct OffsetControlBlock {
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "Counters shared between processes must be lock-free");
+
+    AtomicPolicy::Counts counts{PackedCounts::kSoleOwner};
+    OffsetPtr<ShmHeap> heap;
+    alignas(T) std::byte storage[sizeof(T)];
+
+    explicit OffsetControlBlock(ShmHeap* owner) : heap(owner) {
+    }
+
+    T* Get() {
+        return std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    void PlusCounter() {
+        AtomicPolicy::Add(counts, PackedCounts::kStrong);
+    }
+    void PlusWeakCounter() {
+        AtomicPolicy::Add(counts, PackedCounts::kWeak);
+    }
+    bool TryPlusCounter() {
+        return AtomicPolicy::AddStrongIfNonZero(counts);
+    }
+    void MinusCounter() {
+        uint64_t old = AtomicPolicy::Subtract(counts, PackedCounts::kStrong);
+        if (PackedCounts::Strong(old) == 1) {
+            Get()->~T();
+            MinusWeakCounter();
+        }
+    }
+    void MinusWeakCounter() {
+        uint64_t old = AtomicPolicy::Subtract(counts, PackedCounts::kWeak);
+        if (PackedCounts::Weak(old) == 1) {
+            ShmHeap* owner = heap.Get();
+            this->~OffsetControlBlock();
+            owner->Deallocate(this);
+        }
+    }
+    size_t UseCount() const {
+        return PackedCounts::Strong(AtomicPolicy::Load(counts));
+    }
+};
+
+template <typename T>
+class OffsetSharedPtr;
+
+// A mapping of a shared-memory segment in this process. Move-only; destroying it unmaps the
+// segment but leaves the objects in it to the other processes.
+class ShmSegment {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    // Anonymous segment, shared with children forked later or through `Fd()`
+    static ShmSegment CreateAnonymous(size_t size) {
+#ifdef __linux__
+        int fd = ::memfd_create("smart_ptrs_shm", MFD_CLOEXEC);
+        if (fd == -1) {
+            ThrowSystemError("memfd_create");
+        }
+        return ShmSegment(fd, size, true);
+#else
+        std::string name = "/smart_ptrs_shm." + std::to_string(::getpid()) + "." +
+                           std::to_string(anonymous_count_.fetch_add(1));
+        ShmSegment segment = Create(name, size);
+        Unlink(name);
+        return segment;
+#endif
+    }
+
+    // Named POSIX shared memory, fails if `name` exists
+    static ShmSegment Create(const std::string& name, size_t size) {
+        int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd == -1) {
+            ThrowSystemError("shm_open");
+        }
+        try {
+            return ShmSegment(fd, size, true);
+        } catch (...) {
+            Unlink(name);
+            throw;
+        }
+    }
+    static ShmSegment Open(const std::string& name) {
+        int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd == -1) {
+            ThrowSystemError("shm_open");
+        }
+        return Adopt(fd);
+    }
+    // Maps a segment received as a file descriptor and takes the descriptor over
+    static ShmSegment Adopt(int fd) {
+        struct stat info;
+        if (::fstat(fd, &info) == -1) {
+            int error = errno;
+            ::close(fd);
+            ThrowSystemError("fstat", error);
+        }
+        return ShmSegment(fd, static_cast<size_t>(info.st_size), false);
+    }
+
+    // Removes the name, mappings stay valid
+    static void Unlink(const std::string& name) {
+        ::shm_unlink(name.c_str());
+    }
+
+    ShmSegment(const ShmSegment&) = delete;
+    ShmSegment(ShmSegment&& other) noexcept
+        : fd_(std::exchange(other.fd_, -1)),
+          size_(std::exchange(other.size_, 0)),
+          heap_(std::exchange(other.heap_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // operator=-s
+
+    ShmSegment& operator=(const ShmSegment&) = delete;
+    ShmSegment& operator=(ShmSegment&& other) noexcept {
+        ShmSegment(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ShmSegment() {
+        if (heap_ != nullptr) {
+            ::munmap(heap_, size_);
+        }
+        if (fd_ != -1) {
+            ::close(fd_);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Stores a reference to `ptr`'s object in the root slot and releases the previous one, which
+    // must have been published as a `T` as well. Publish nullptr to empty the slot.
+    template <typename T>
+    void PublishRoot(const OffsetSharedPtr<T>& ptr);
+
+    void Swap(ShmSegment& other) noexcept {
+        std::swap(fd_, other.fd_);
+        std::swap(size_, other.size_);
+        std::swap(heap_, other.heap_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // The object in the root slot, which must have been published as a `T`; empty if none
+    template <typename T>
+    OffsetSharedPtr<T> Root() const;
+
+    ShmHeap& Heap() const {
+        return *heap_;
+    }
+    int Fd() const {
+        return fd_;
+    }
+    size_t Size() const {
+        return size_;
+    }
+    size_t FreeBytes() const {
+        return heap_->FreeBytes();
+    }
+
+private:
+    ShmSegment(int fd, size_t size, bool format) : fd_(fd), size_(size) {
+        if (format && ::ftruncate(fd_, static_cast<off_t>(size_)) == -1) {
+            Fail("ftruncate");
+        }
+        void* base = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (base == MAP_FAILED) {
+            Fail("mmap");
+        }
+        try {
+            heap_ = format ? ShmHeap::Format(base, size_) : ShmHeap::Attach(base, size_);
+        } catch (...) {
+            ::munmap(base, size_);
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    [[noreturn]] static void ThrowSystemError(const char* what, int error = errno) {
+        throw std::system_error(error, std::generic_category(), what);
+    }
+    [[noreturn]] void Fail(const char* what) {
+        int error = errno;
+        ::close(fd_);
+        ThrowSystemError(what, error);
+    }
+
+#ifndef __linux__
+    static inline std::atomic<uint64_t> anonymous_count_{0};
+#endif
+
+    int fd_ = -1;
+    size_t size_ = 0;
+    ShmHeap* heap_ = nullptr;
+};
+
+template <typename T>
+class OffsetWeakPtr;
+
+template <typename T>
+class OffsetSharedPtr {
+    static_assert(!std::is_array_v<T>, "Arrays are not supported");
+
+    using Block = OffsetControlBlock<T>;
+
+    OffsetPtr<Block> block_;
+
+    // Adopts a reference
+    explicit OffsetSharedPtr(Block* block) : block_(block) {
+    }
+
+    template <typename Y>
+    friend class OffsetWeakPtr;
+    friend class ShmSegment;
+
+    template <typename Y, typename... Args>
+    friend OffsetSharedPtr<Y> MakeOffsetShared(ShmSegment& segment, Args&&... args);
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    OffsetSharedPtr() = default;
+    OffsetSharedPtr(std::nullptr_t) {
+    }
+
+    OffsetSharedPtr(const OffsetSharedPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->PlusCounter();
+        }
+    }
+    OffsetSharedPtr(OffsetSharedPtr&& other) noexcept : block_(other.block_) {
+        other.block_ = nullptr;
+    }
+
+    // Promotes a weak pointer, throws `BadWeakPtr` if the object is gone
+    explicit OffsetSharedPtr(const OffsetWeakPtr<T>& other) {
+        if (!other.block_ || !other.block_->TryPlusCounter()) {
+            throw BadWeakPtr();
+        }
+        block_ = other.block_;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // operator=-s
+
+    OffsetSharedPtr& operator=(const OffsetSharedPtr& other) {
+        OffsetSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    OffsetSharedPtr& operator=(OffsetSharedPtr&& other) noexcept {
+        OffsetSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~OffsetSharedPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (Block* block = block_.Get(); block != nullptr) {
+            block_ = nullptr;
+            block->MinusCounter();
+        }
+    }
+    void Swap(OffsetSharedPtr& other) noexcept {
+        Block* block = block_.Get();
+        block_ = other.block_;
+        other.block_ = block;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return block_ ? block_->Get() : nullptr;
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    size_t UseCount() const {
+        return block_ ? block_->UseCount() : 0;
+    }
+    explicit operator bool() const {
+        return static_cast<bool>(block_);
+    }
+};
+
+template <typename T>
+inline bool operator==(const OffsetSharedPtr<T>& left, const OffsetSharedPtr<T>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T>
+class OffsetWeakPtr {
+    using Block = OffsetControlBlock<T>;
+
+    OffsetPtr<Block> block_;
+
+    template <typename Y>
+    friend class OffsetSharedPtr;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    OffsetWeakPtr() = default;
+
+    OffsetWeakPtr(const OffsetWeakPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->PlusWeakCounter();
+        }
+    }
+    OffsetWeakPtr(OffsetWeakPtr&& other) noexcept : block_(other.block_) {
+        other.block_ = nullptr;
+    }
+
+    OffsetWeakPtr(const OffsetSharedPtr<T>& other) : block_(other.block_) {
+        if (block_) {
+            block_->PlusWeakCounter();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // operator=-s
+
+    OffsetWeakPtr& operator=(const OffsetWeakPtr& other) {
+        OffsetWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    OffsetWeakPtr& operator=(OffsetWeakPtr&& other) noexcept {
+        OffsetWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~OffsetWeakPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (Block* block = block_.Get(); block != nullptr) {
+            block_ = nullptr;
+            block->MinusWeakCounter();
+        }
+    }
+    void Swap(OffsetWeakPtr& other) noexcept {
+        Block* block = block_.Get();
+        block_ = other.block_;
+        other.block_ = block;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const {
+        return block_ ? block_->UseCount() : 0;
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    OffsetSharedPtr<T> Lock() const {
+        OffsetSharedPtr<T> result;
+        if (block_ && block_->TryPlusCounter()) {
+            result.block_ = block_;
+        }
+        return result;
+    }
+};
+
+// Creates the object in `segment`, throws `std::bad_alloc` if the segment is full
+template <typename T, typename... Args>
+OffsetSharedPtr<T> MakeOffsetShared(ShmSegment& segment, Args&&... args) {
+    static_assert(alignof(T) <= ShmHeap::kAlignment, "The segment aligns objects to 16 bytes");
+    using Block = OffsetControlBlock<T>;
+    ShmHeap& heap = segment.Heap();
+    void* memory = heap.Allocate(sizeof(Block));
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    auto block = ::new (memory) Block(&heap);
+    try {
+        ::new (static_cast<void*>(block->storage)) T(std::forward<Args>(args)...);
+    } catch (...) {
+        block->~Block();
+        heap.Deallocate(memory);
+        throw;
+    }
+    return OffsetSharedPtr<T>(block);
+}
+
+// Under the heap lock, so that a reader never increments a block another process is releasing
+template <typename T>
+void ShmSegment::PublishRoot(const OffsetSharedPtr<T>& ptr) {
+    using Block = OffsetControlBlock<T>;
+    Block* block = ptr.block_.Get();
+    if (block != nullptr) {
+        block->PlusCounter();
+    }
+    uint64_t old;
+    {
+        ShmHeap::LockGuard guard(heap_->lock_);
+        old = std::exchange(heap_->root_, block != nullptr ? heap_->OffsetOf(block) : 0);
+    }
+    if (old != 0) {
+        reinterpret_cast<Block*>(heap_->At(old))->MinusCounter();
+    }
+}
+
+template <typename T>
+OffsetSharedPtr<T> ShmSegment::Root() const {
+    using Block = OffsetControlBlock<T>;
+    ShmHeap::LockGuard guard(heap_->lock_);
+    if (heap_->root_ == 0) {
+        return nullptr;
+    }
+    auto block = reinterpret_cast<Block*>(heap_->At(heap_->root_));
+    block->PlusCounter();
+    return OffsetSharedPtr<T>(block);
+}
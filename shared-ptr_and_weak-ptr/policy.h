@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Locking policies for `ControlBlock` reference counters.
+// A policy chooses the counter type and how it is updated, so the price of thread safety is
+// fixed at compile time: `SharedPtr<T, SingleThreadedPolicy>` never touches an atomic and
+// `SharedPtr<T, AtomicPolicy>` may be copied and destroyed from any thread.
+//
+// The strong and the weak count share one 64-bit word laid out by `PackedCounts`, so a single
+// operation updates or tests both. Every policy provides:
+//   Counts                              - storage of the word, constructible from `uint64_t`
+//   Add(counts, delta)                  - take references
+//   Subtract(counts, delta) -> uint64_t - drop references, returns the previous word
+//   AddStrongIfNonZero(counts) -> bool  - add a strong reference unless there is none left
+//   Load(counts) -> uint64_t            - current word, ordered after every earlier release
+//   Store(counts, word)                 - overwrite the word, only while nobody else refers to it
+//
+// A policy whose counting does not fit this interface specializes `ControlBlock` instead,
+// see biased.h.
+// `DeferredPolicy<Policy>` (deferred.h) keeps a policy's counting and moves the destruction off
+// the releasing thread.
+
+// Strong count in the low half of the word, weak count in the high half. Each count is limited
+// to 2^32 - 1 references.
+struct PackedCounts {
+    static constexpr uint64_t kStrong = 1;
+    static constexpr uint64_t kWeak = uint64_t{1} << 32;
+    static constexpr uint64_t kStrongMask = kWeak - 1;
+    // One strong reference plus the weak reference all strong ones hold together. This is the
+    // initial word, and a releasing owner that still reads it is the only one left.
+    static constexpr uint64_t kSoleOwner = kStrong | kWeak;
+
+    static constexpr size_t Strong(uint64_t word) {
+        return word & kStrongMask;
+    }
+    static constexpr size_t Weak(uint64_t word) {
+        return word >> 32;
+    }
+};
+
+// Plain counters, today's fast path. Not safe to share between threads.
+struct SingleThreadedPolicy {
+    using Counts = uint64_t;
+
+    static void Add(Counts& counts, uint64_t delta) {
+        counts += delta;
+    }
+    static uint64_t Subtract(Counts& counts, uint64_t delta) {
+        uint64_t old = counts;
+        counts -= delta;
+        return old;
+    }
+    static bool AddStrongIfNonZero(Counts& counts) {
+        if (PackedCounts::Strong(counts) == 0) {
+            return false;
+        }
+        counts += PackedCounts::kStrong;
+        return true;
+    }
+    static uint64_t Load(const Counts& counts) {
+        return counts;
+    }
+    static void Store(Counts& counts, uint64_t word) {
+        counts = word;
+    }
+};
+
+// Same scheme as libstdc++/libc++: taking a reference needs no ordering since the caller
+// already owns one, dropping a reference releases our writes to the object and the thread that
+// drops the last one acquires everybody else's before running the destructor.
+struct AtomicPolicy {
+    using Counts = std::atomic<uint64_t>;
+
+    static void Add(Counts& counts, uint64_t delta) {
+        counts.fetch_add(delta, std::memory_order_relaxed);
+    }
+    static uint64_t Subtract(Counts& counts, uint64_t delta) {
+        return counts.fetch_sub(delta, std::memory_order_acq_rel);
+    }
+    // Single CAS in the common case, the loop only retries on contention
+    static bool AddStrongIfNonZero(Counts& counts) {
+        uint64_t value = counts.load(std::memory_order_relaxed);
+        do {
+            if (PackedCounts::Strong(value) == 0) {
+                return false;
+            }
+        } while (!counts.compare_exchange_weak(value, value + PackedCounts::kStrong,
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+        return true;
+    }
+    // Acquire, so that an owner which finds itself the last one by a plain load also sees the
+    // writes of the owners that left before it
+    static uint64_t Load(const Counts& counts) {
+        return counts.load(std::memory_order_acquire);
+    }
+    // A plain store, no other thread can be looking
+    static void Store(Counts& counts, uint64_t word) {
+        counts.store(word, std::memory_order_relaxed);
+    }
+};
+
+using DefaultLockPolicy = SingleThreadedPolicy;
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+// Per-thread, size-classed slab pool for control blocks.
+//
+// Memory comes in 64 KiB slabs aligned to their size, so the slab of a block is found by
+// masking its address. Every slab belongs to one thread cache and serves one size class
+// (multiples of 16 bytes up to 256). The owning thread allocates and frees without atomics;
+// a block freed on another thread is pushed onto its slab's lock-free remote list, and the
+// slab is announced to the owner, which folds the list back in on its next slow-path
+// allocation. Thread caches are never destroyed: when a thread exits its cache, slabs included,
+// is parked and handed to the next new thread.
+class ControlBlockPool {
+public:
+    static constexpr size_t kAlignment = 16;
+    static constexpr size_t kMaxBlockSize = 256;
+    static constexpr size_t kSlabSize = size_t{64} << 10;
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxBlockSize) {
+            return ::operator new(size);
+        }
+        if (ThreadCache* cache = ThreadCache::Current()) {
+            return cache->Allocate(ClassOf(size));
+        }
+        return ThreadCache::Orphan().LockedAllocate(ClassOf(size));
+    }
+
+    static void Deallocate(void* ptr, size_t size) noexcept {
+        if (size > kMaxBlockSize) {
+            ::operator delete(ptr, size);
+            return;
+        }
+        Slab* slab = SlabOf(ptr);
+        if (slab->owner == ThreadCache::Peek()) {
+            slab->owner->LocalFree(slab, ptr);
+        } else {
+            slab->RemoteFree(ptr);
+        }
+    }
+
+private:
+    static constexpr size_t kClasses = kMaxBlockSize / kAlignment;
+
+    class ThreadCache;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct Slab {
+        // Fixed for the slab's lifetime
+        ThreadCache* const owner;
+        const size_t size_class;
+        const size_t block_size;
+
+        // Owner only
+        FreeNode* local_free = nullptr;
+        std::byte* bump;
+        std::byte* const end;
+        size_t used = 0;
+        Slab* prev_partial = nullptr;
+        Slab* next_partial = nullptr;
+        bool in_partial = false;
+
+        // Blocks freed by other threads, and the link in the owner's list of such slabs
+        std::atomic<FreeNode*> remote_free{nullptr};
+        Slab* next_remote = nullptr;
+
+        Slab(ThreadCache* cache, size_t cls)
+            : owner(cache),
+              size_class(cls),
+              block_size((cls + 1) * kAlignment),
+              bump(reinterpret_cast<std::byte*>(this) + kHeaderSize),
+              end(reinterpret_cast<std::byte*>(this) + kSlabSize) {
+        }
+
+        void* Pop() {
+            void* ptr = nullptr;
+            if (local_free != nullptr) {
+                ptr = local_free;
+                local_free = local_free->next;
+            } else if (bump + block_size <= end) {
+                ptr = bump;
+                bump += block_size;
+            } else {
+                return nullptr;
+            }
+            ++used;
+            return ptr;
+        }
+        bool HasFree() const {
+            return local_free != nullptr || bump + block_size <= end;
+        }
+
+        void RemoteFree(void* ptr) {
+            auto node = static_cast<FreeNode*>(ptr);
+            FreeNode* head = remote_free.load(std::memory_order_relaxed);
+            do {
+                node->next = head;
+            } while (!remote_free.compare_exchange_weak(head, node, std::memory_order_acq_rel,
+                                                        std::memory_order_relaxed));
+            // The first remote free since the last drain tells the owner where to look. Seeing
+            // the list empty acquires the drain, so the owner is done with `next_remote`.
+            if (head == nullptr) {
+                owner->AnnounceRemote(this);
+            }
+        }
+    };
+
+    static constexpr size_t kHeaderSize = (sizeof(Slab) + 63) / 64 * 64;
+
+    static size_t ClassOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kAlignment;
+    }
+    static Slab* SlabOf(void* ptr) {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(kSlabSize - 1));
+    }
+
+    class ThreadCache {
+    public:
+        // nullptr once the thread has started exiting
+        static ThreadCache* Current() {
+            if (current_ == nullptr && !exiting_) {
+                current_ = Adopt();
+                exit_.Arm();
+            }
+            return current_;
+        }
+        static ThreadCache* Peek() {
+            return current_;
+        }
+        // Serves threads that allocate while exiting. Nobody owns it, so every free into its
+        // slabs takes the remote path and it only allocates under a lock.
+        static ThreadCache& Orphan() {
+            static ThreadCache* orphan = new ThreadCache();
+            return *orphan;
+        }
+
+        void* Allocate(size_t cls) {
+            if (Slab* slab = classes_[cls].current) {
+                if (void* ptr = slab->Pop()) {
+                    return ptr;
+                }
+            }
+            return AllocateSlow(cls);
+        }
+        void* LockedAllocate(size_t cls) {
+            std::lock_guard guard(OrphanMutex());
+            return Allocate(cls);
+        }
+
+        void LocalFree(Slab* slab, void* ptr) {
+            auto node = static_cast<FreeNode*>(ptr);
+            node->next = slab->local_free;
+            slab->local_free = node;
+            --slab->used;
+            SizeClass& size_class = classes_[slab->size_class];
+            if (slab == size_class.current) {
+                return;
+            }
+            if (slab->used == 0) {
+                Unlink(size_class, slab);
+                slab->~Slab();
+                ::operator delete(slab, std::align_val_t{kSlabSize});
+            } else if (!slab->in_partial) {
+                Link(size_class, slab);
+            }
+        }
+
+        void AnnounceRemote(Slab* slab) {
+            Slab* head = remote_slabs_.load(std::memory_order_relaxed);
+            do {
+                slab->next_remote = head;
+            } while (!remote_slabs_.compare_exchange_weak(head, slab, std::memory_order_release,
+                                                          std::memory_order_relaxed));
+        }
+
+    private:
+        struct SizeClass {
+            Slab* current = nullptr;
+            // Non-current slabs with free blocks
+            Slab* partial = nullptr;
+        };
+
+        struct ThreadExit {
+            void Arm() {
+            }
+            ~ThreadExit() {
+                exiting_ = true;
+                if (ThreadCache* cache = current_) {
+                    current_ = nullptr;
+                    std::lock_guard guard(ParkMutex());
+                    cache->next_parked_ = parked_;
+                    parked_ = cache;
+                }
+            }
+        };
+
+        static ThreadCache* Adopt() {
+            {
+                std::lock_guard guard(ParkMutex());
+                if (ThreadCache* cache = parked_) {
+                    parked_ = cache->next_parked_;
+                    return cache;
+                }
+            }
+            return new ThreadCache();
+        }
+
+        void* AllocateSlow(size_t cls) {
+            DrainRemote();
+            SizeClass& size_class = classes_[cls];
+            if (size_class.current != nullptr && size_class.current->HasFree()) {
+                return size_class.current->Pop();
+            }
+            // The full slab comes back through `LocalFree` once one of its blocks is freed
+            if (Slab* slab = size_class.partial) {
+                Unlink(size_class, slab);
+                size_class.current = slab;
+            } else {
+                void* memory = ::operator new(kSlabSize, std::align_val_t{kSlabSize});
+                size_class.current = ::new (memory) Slab(this, cls);
+            }
+            return size_class.current->Pop();
+        }
+
+        void DrainRemote() {
+            Slab* slab = remote_slabs_.exchange(nullptr, std::memory_order_acquire);
+            while (slab != nullptr) {
+                Slab* next = slab->next_remote;
+                // Releases our read of `next_remote` to the next announcing thread
+                FreeNode* node = slab->remote_free.exchange(nullptr, std::memory_order_acq_rel);
+                while (node != nullptr) {
+                    FreeNode* next_node = node->next;
+                    LocalFree(slab, node);
+                    node = next_node;
+                }
+                slab = next;
+            }
+        }
+
+        static void Link(SizeClass& size_class, Slab* slab) {
+            slab->prev_partial = nullptr;
+            slab->next_partial = size_class.partial;
+            if (size_class.partial != nullptr) {
+                size_class.partial->prev_partial = slab;
+            }
+            size_class.partial = slab;
+            slab->in_partial = true;
+        }
+        static void Unlink(SizeClass& size_class, Slab* slab) {
+            if (!slab->in_partial) {
+                return;
+            }
+            if (slab->prev_partial != nullptr) {
+                slab->prev_partial->next_partial = slab->next_partial;
+            } else {
+                size_class.partial = slab->next_partial;
+            }
+            if (slab->next_partial != nullptr) {
+                slab->next_partial->prev_partial = slab->prev_partial;
+            }
+            slab->in_partial = false;
+        }
+
+        static std::mutex& ParkMutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+        static std::mutex& OrphanMutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        SizeClass classes_[kClasses];
+        std::atomic<Slab*> remote_slabs_{nullptr};
+        ThreadCache* next_parked_ = nullptr;
+
+        static inline ThreadCache* parked_ = nullptr;
+        static inline thread_local ThreadCache* current_ = nullptr;
+        static inline thread_local bool exiting_ = false;
+        static inline thread_local ThreadExit exit_;
+    };
+};
+
+// Routes `new`/`delete` of control blocks through `ControlBlockPool`
+struct PoolAllocated {
+    static void* operator new(size_t size) {
+        return ControlBlockPool::Allocate(size);
+    }
+    static void operator delete(void* ptr, size_t size) noexcept {
+        ControlBlockPool::Deallocate(ptr, size);
+    }
+    // Over-aligned blocks bypass the pool
+    static void* operator new(size_t size, std::align_val_t alignment) {
+        return ::operator new(size, alignment);
+    }
+    static void operator delete(void* ptr, size_t size, std::align_val_t alignment) noexcept {
+        ::operator delete(ptr, size, alignment);
+    }
+};
+
+// Standard allocator over `ControlBlockPool`, e.g. for `AllocateShared`
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        if constexpr (alignof(T) > ControlBlockPool::kAlignment) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+        } else {
+            return static_cast<T*>(ControlBlockPool::Allocate(n * sizeof(T)));
+        }
+    }
+    void deallocate(T* ptr, size_t n) noexcept {
+        if constexpr (alignof(T) > ControlBlockPool::kAlignment) {
+            ::operator delete(ptr, n * sizeof(T), std::align_val_t{alignof(T)});
+        } else {
+            ControlBlockPool::Deallocate(ptr, n * sizeof(T));
+        }
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept {
+        return false;
+    }
+};
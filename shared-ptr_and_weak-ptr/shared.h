@@ -1,68 +1,171 @@
 #pragma once
 
+#include "../common/relocation.h"
 #include "sw_fwd.h"  // Forward declaration
 #include <cstddef>   // std::nullptr_t
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <span>
+#include <type_traits>
+#include <vector>
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
 
 // Look for usage examples in tests
 class EnableSharedFromThisBase {};
 
-template <typename T>
+template <typename T, typename Policy = DefaultLockPolicy>
 class EnableSharedFromThis : public EnableSharedFromThisBase {
-    template <typename Z>
-    friend class WearPtr;
+    template <typename Z, typename P>
+    friend class WeakPtr;
 
-    template <typename Z>
+    template <typename Z, typename P>
     friend class SharedPtr;
 
-    WeakPtr<T> weak_this_;
+    WeakPtr<T, Policy> weak_this_;
 
 public:
     EnableSharedFromThis() = default;
-    SharedPtr<T> SharedFromThis() {
+    SharedPtr<T, Policy> SharedFromThis() {
         return weak_this_.Lock();
     };
-    SharedPtr<const T> SharedFromThis() const {
+    SharedPtr<const T, Policy> SharedFromThis() const {
         return weak_this_.Lock();
     };
 
-    WeakPtr<T> WeakFromThis() noexcept {
+    WeakPtr<T, Policy> WeakFromThis() noexcept {
         return weak_this_;
     };
-    WeakPtr<const T> WeakFromThis() const noexcept {
+    WeakPtr<const T, Policy> WeakFromThis() const noexcept {
         return weak_this_;
     };
 };
 
+// Same interface as `EnableSharedFromThis`, but without a `WeakPtr` in every object: the control
+// block is found at its fixed offset in front of the object, so the base takes no space and
+// creating an object takes no weak reference.
+// That offset is only fixed for objects created by `MakeShared<T>` (or `MakeCompactShared<T>`) of
+// exactly `T` with the same policy, which then keeps them inline whatever their size. The other
+// ways to create a `SharedPtr` do not compile for such classes.
+// Calling these methods on an object created otherwise (on the stack, as a member, with plain
+// `new`) is undefined behavior. Builds without `NDEBUG` check the control block in front of the
+// object, which catches such calls in practice: `SharedFromThis` throws `BadWeakPtr` and
+// `WeakFromThis`, being `noexcept`, terminates.
+template <typename T, typename Policy = DefaultLockPolicy>
+class EnableSharedFromThisInline {
+public:
+    using InlineSharedFromThisType = T;
+    using InlineSharedFromThisPolicy = Policy;
+
+    // Empty while the object is being destroyed
+    SharedPtr<T, Policy> SharedFromThis() {
+        auto block = Block();
+        if (!block->TryPlusCounter()) {
+            return nullptr;
+        }
+        return SharedPtr<T, Policy>(block, block->GetPtr());
+    }
+    SharedPtr<const T, Policy> SharedFromThis() const {
+        auto block = Block();
+        if (!block->TryPlusCounter()) {
+            return nullptr;
+        }
+        return SharedPtr<const T, Policy>(block, static_cast<const T*>(block->GetPtr()));
+    }
+
+    WeakPtr<T, Policy> WeakFromThis() noexcept {
+        return MakeWeak<T>();
+    }
+    WeakPtr<const T, Policy> WeakFromThis() const noexcept {
+        return MakeWeak<const T>();
+    }
+
+protected:
+    EnableSharedFromThisInline() = default;
+    EnableSharedFromThisInline(const EnableSharedFromThisInline&) = default;
+    EnableSharedFromThisInline& operator=(const EnableSharedFromThisInline&) = default;
+    ~EnableSharedFromThisInline() = default;
+
+private:
+    ControlBlockAllocator<T, Policy>* Block() const {
+        using InlineBlock = ControlBlockAllocator<T, Policy>;
+        auto self = const_cast<T*>(static_cast<const T*>(this));
+        InlineBlock* block = InlineBlock::FromPtr(self);
+#ifndef NDEBUG
+        // Reads whatever is in front of a stray object, which is unlikely to be this pointer
+        if (block->ops != &kControlBlockOps<InlineBlock, Policy>) {
+            throw BadWeakPtr();
+        }
+#endif
+        return block;
+    }
+
+    template <typename Z>
+    WeakPtr<Z, Policy> MakeWeak() const {
+        WeakPtr<Z, Policy> result;
+        auto block = Block();
+        block->PlusWeakCounter();
+        result.ptr_ = block->GetPtr();
+        result.block_ = block;
+        return result;
+    }
+};
+
 template <typename T>
+concept InlineSharedFromThis = requires { typename T::InlineSharedFromThisType; };
+
+// True unless `T` derives from `EnableSharedFromThisInline` for another class or policy
+template <typename T, typename Policy>
+inline constexpr bool kInlineSharedFromThisMatches = [] {
+    if constexpr (InlineSharedFromThis<T>) {
+        return std::is_same_v<typename T::InlineSharedFromThisType, T> &&
+               std::is_same_v<typename T::InlineSharedFromThisPolicy, Policy>;
+    } else {
+        return true;
+    }
+}();
+
+template <typename T, typename Policy>
 class SharedPtr {
-    T* ptr_ = nullptr;
-    ControlBlock* block_ = nullptr;
+public:
+    // `T` itself, or the element type for `SharedPtr<T[]>` and `SharedPtr<T[N]>`
+    using ElementType = std::remove_extent_t<T>;
 
-    template <typename K, typename... Args>
-    friend SharedPtr<K> MakeShared(Args&&... args);
+private:
+    ElementType* ptr_ = nullptr;
+    ControlBlock<Policy>* block_ = nullptr;
 
-    template <typename Z>
+    template <typename Z, typename P>
     friend class SharedPtr;
 
-    template <typename Z>
+    template <typename Z, typename P>
     friend class WeakPtr;
 
-    template <typename Z>
+    template <typename Z, typename P>
     friend class EnableSharedFromThis;
 
-    void SharedFromThisIfNeeded(T* ptr) {
+    template <typename Z, typename P>
+    friend class CompactSharedPtr;
+
+    template <typename Z, typename P, typename OutputIt>
+    friend OutputIt ShareN(const SharedPtr<Z, P>& ptr, size_t n, OutputIt out);
+
+    template <typename Z, typename P>
+    friend void ReleaseAll(std::span<SharedPtr<Z, P>> ptrs);
+
+    void SharedFromThisIfNeeded(ElementType* ptr) {
         if (ptr_ && block_) {
-            if constexpr (std::is_convertible_v<T*, EnableSharedFromThisBase*>) {
+            if constexpr (!std::is_array_v<T> &&
+                          std::is_convertible_v<T*, EnableSharedFromThisBase*>) {
                 InitWeakThis(ptr);
             }
         }
     }
 
     template <typename Y>
-    void InitWeakThis(EnableSharedFromThis<Y>* e) {
-        e->weak_this_ = WeakPtr<Y>(*this);
+    void InitWeakThis(EnableSharedFromThis<Y, Policy>* e) {
+        e->weak_this_ = WeakPtr<Y, Policy>(*this);
     }
 
 public:
@@ -71,8 +174,14 @@ public:
 
     SharedPtr() = default;
     SharedPtr(std::nullptr_t) : ptr_(nullptr), block_(nullptr){};
+    // `SharedPtr<T[]>(new T[n])` releases the array with `delete[]`
     template <typename Z>
-    explicit SharedPtr(Z* ptr) : ptr_(ptr), block_(new ControlBlockPointer<Z>(ptr)) {
+    explicit SharedPtr(Z* ptr)
+        : ptr_(ptr),
+          block_(new ControlBlockPointer<std::conditional_t<std::is_array_v<T>, Z[], Z>, Policy>(
+              ptr)) {
+        static_assert(!InlineSharedFromThis<Z>,
+                      "Create EnableSharedFromThisInline with MakeShared");
         SharedFromThisIfNeeded(ptr);
     };
 
@@ -82,29 +191,30 @@ public:
         }
     };
     template <typename Z>
-    SharedPtr(const SharedPtr<Z>& other) : ptr_(other.ptr_), block_(other.block_) {
+    SharedPtr(const SharedPtr<Z, Policy>& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_ != nullptr) {
             block_->PlusCounter();
         }
     };
     template <typename Z>
-    SharedPtr(SharedPtr<Z>&& other) : ptr_(other.ptr_), block_(other.block_) {
+    SharedPtr(SharedPtr<Z, Policy>&& other) noexcept : ptr_(other.ptr_), block_(other.block_) {
         other.ptr_ = nullptr;
         other.block_ = nullptr;
     };
-    SharedPtr(SharedPtr&& other) : ptr_(other.ptr_), block_(other.block_) {
+    SharedPtr(SharedPtr&& other) noexcept : ptr_(other.ptr_), block_(other.block_) {
         other.ptr_ = nullptr;
         other.block_ = nullptr;
     }
     template <typename Z>
-    SharedPtr(ControlBlock* block, Z* ptr) : ptr_(ptr), block_(block) {
+    SharedPtr(ControlBlock<Policy>* block, Z* ptr) : ptr_(ptr), block_(block) {
         SharedFromThisIfNeeded(ptr);
     }
 
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Z>
-    SharedPtr(const SharedPtr<Z>& other, T* ptr) : ptr_(ptr), block_(other.block_) {
+    SharedPtr(const SharedPtr<Z, Policy>& other, ElementType* ptr)
+        : ptr_(ptr), block_(other.block_) {
         if (block_ != nullptr) {
             block_->PlusCounter();
         }
@@ -112,11 +222,10 @@ public:
 
     // Promote WeakPtr
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.block_ != nullptr && other.UseCount() != 0) {
+    explicit SharedPtr(const WeakPtr<T, Policy>& other) {
+        if (other.block_ != nullptr && other.block_->TryPlusCounter()) {
             ptr_ = other.ptr_;
             block_ = other.block_;
-            block_->PlusCounter();
         } else {
             throw BadWeakPtr();
         }
@@ -125,44 +234,23 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // operator=-s
 
-    template <typename Z>
-    SharedPtr& operator=(const SharedPtr<Z>& other) {
-        if (this->Get() != other.Get()) {
-            Reset();
-            ptr_ = other.ptr_;
-            block_ = other.block_;
-
-            if (block_ != nullptr) {
-                block_->PlusCounter();
-            }
-        }
+    // Copy-and-swap: the old value is released last, after `*this` is consistent
+    SharedPtr& operator=(const SharedPtr& other) {
+        SharedPtr(other).Swap(*this);
+        return *this;
+    }
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     }
-
     template <typename Z>
-    SharedPtr& operator=(SharedPtr<Z>&& other) {
-        if (this->Get() != other.Get()) {
-            Reset();
-            ptr_ = other.ptr_;
-            block_ = other.block_;
-
-            other.ptr_ = nullptr;
-            other.block_ = nullptr;
-        }
+    SharedPtr& operator=(const SharedPtr<Z, Policy>& other) {
+        SharedPtr(other).Swap(*this);
         return *this;
     }
-
     template <typename Z>
-    SharedPtr& operator=(SharedPtr<Z>& other) {
-        if (this->Get() != other.Get()) {
-            Reset();
-            ptr_ = other.ptr_;
-            block_ = other.block_;
-
-            if (block_ != nullptr) {
-                block_->PlusCounter();
-            }
-        }
+    SharedPtr& operator=(SharedPtr<Z, Policy>&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     }
 
@@ -179,34 +267,44 @@ public:
     void Reset() {
         if (block_ != nullptr) {
             block_->MinusCounter();
-            ptr_ = nullptr;
             block_ = nullptr;
         }
+        // Uncounted pointers (arena.h) have no block
+        ptr_ = nullptr;
     }
     template <typename Z>
     void Reset(Z* ptr) {
         SharedPtr(ptr).Swap(*this);
     }
-    void Swap(SharedPtr& other) {
+    void Swap(SharedPtr& other) noexcept {
         std::swap(ptr_, other.ptr_);
         std::swap(block_, other.block_);
     }
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    ControlBlock* GetBlock() const {
+    ControlBlock<Policy>* GetBlock() const {
         return block_;
     }
 
-    T* Get() const {
+    ElementType* Get() const {
         return ptr_;
     }
-    T& operator*() const {
+    ElementType& operator*() const
+        requires(!std::is_array_v<T>)
+    {
         return *ptr_;
     }
-    T* operator->() const {
+    ElementType* operator->() const
+        requires(!std::is_array_v<T>)
+    {
         return ptr_;
     }
+    ElementType& operator[](ptrdiff_t index) const
+        requires std::is_array_v<T>
+    {
+        return ptr_[index];
+    }
     size_t UseCount() const {
         if (block_ != nullptr) {
             return block_->GetCounter();
@@ -216,16 +314,189 @@ public:
     explicit operator bool() const {
         return ptr_ != nullptr;
     }
+
+    // Ordering, equality and hashing by control block instead of by pointer: aliases of one
+    // object are equivalent, and an expired `WeakPtr` keeps its place among the keys
+    // https://en.cppreference.com/w/cpp/memory/shared_ptr/owner_before
+    template <typename Z>
+    bool OwnerBefore(const SharedPtr<Z, Policy>& other) const {
+        return std::less<ControlBlock<Policy>*>()(block_, other.block_);
+    }
+    template <typename Z>
+    bool OwnerBefore(const WeakPtr<Z, Policy>& other) const {
+        return std::less<ControlBlock<Policy>*>()(block_, other.block_);
+    }
+    template <typename Z>
+    bool OwnerEqual(const SharedPtr<Z, Policy>& other) const {
+        return block_ == other.block_;
+    }
+    template <typename Z>
+    bool OwnerEqual(const WeakPtr<Z, Policy>& other) const {
+        return block_ == other.block_;
+    }
+    size_t OwnerHash() const {
+        return std::hash<ControlBlock<Policy>*>()(block_);
+    }
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
+// Two pointers, relocatable with `memcpy`, see common/relocation.h
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<SharedPtr<T, Policy>> : std::true_type {};
+
+template <typename T, typename U, typename Policy>
+inline bool operator==(const SharedPtr<T, Policy>& left, const SharedPtr<U, Policy>& right) {
     return left.Get() == right.Get();
 }
 
-// Allocate memory only once
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    auto block = new ControlBlockAllocator<T>(std::forward<Args>(args)...);
-    return SharedPtr<T>(block, block->GetPtr());
-}
\ No newline at end of file
+// The object and the block in two allocations, the object's memory is returned once it is
+// destroyed even if weak references keep the block
+template <typename T, typename Policy = DefaultLockPolicy, typename... Args>
+    requires(!std::is_array_v<T>)
+SharedPtr<T, Policy> MakeSharedOutOfLine(Args&&... args) {
+    static_assert(!InlineSharedFromThis<T>, "EnableSharedFromThisInline objects are kept inline");
+    auto block = new ControlBlockOutOfLine<T, Policy>(std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(block, block->GetPtr());
+}
+
+// Allocate memory only once, unless the object is larger than `kMakeSharedInlineLimit` and does
+// not use `EnableSharedFromThisInline`
+template <typename T, typename Policy = DefaultLockPolicy, typename... Args>
+    requires(!std::is_array_v<T>)
+SharedPtr<T, Policy> MakeShared(Args&&... args) {
+    static_assert(kInlineSharedFromThisMatches<T, Policy>,
+                  "EnableSharedFromThisInline<T, Policy> must name this very class and policy");
+    if constexpr (sizeof(T) > kMakeSharedInlineLimit && !InlineSharedFromThis<T>) {
+        return MakeSharedOutOfLine<T, Policy>(std::forward<Args>(args)...);
+    } else {
+        auto block = new ControlBlockAllocator<T, Policy>(std::forward<Args>(args)...);
+        return SharedPtr<T, Policy>(block, block->GetPtr());
+    }
+}
+
+// Same as `MakeShared`, but the single allocation comes from `alloc`
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/allocate_shared
+template <typename T, typename Policy = DefaultLockPolicy, typename Alloc, typename... Args>
+SharedPtr<T, Policy> AllocateShared(const Alloc& alloc, Args&&... args) {
+    static_assert(!InlineSharedFromThis<T>, "Create EnableSharedFromThisInline with MakeShared");
+    using Block = ControlBlockAllocated<T, Alloc, Policy>;
+    auto block = Block::Create(alloc, std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(block, block->GetPtr());
+}
+
+template <typename T, typename Policy, size_t Alignment>
+SharedPtr<T, Policy> MakeSharedArray(size_t size, bool for_overwrite) {
+    using Block = ControlBlockArray<std::remove_extent_t<T>, Policy, Alignment>;
+    auto block = Block::Create(size, for_overwrite);
+    return SharedPtr<T, Policy>(block, block->GetPtr());
+}
+
+// Arrays: the block and `size` value-initialized elements share one allocation, with the first
+// element aligned to `Alignment` bytes (64 by default, enough for aligned AVX-512 loads)
+// #4-#5 from https://en.cppreference.com/w/cpp/memory/shared_ptr/make_shared
+template <typename T, typename Policy = DefaultLockPolicy,
+          size_t Alignment = kSharedArrayAlignment>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T, Policy> MakeShared(size_t size) {
+    return MakeSharedArray<T, Policy, Alignment>(size, false);
+}
+template <typename T, typename Policy = DefaultLockPolicy,
+          size_t Alignment = kSharedArrayAlignment>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T, Policy> MakeShared() {
+    return MakeSharedArray<T, Policy, Alignment>(std::extent_v<T>, false);
+}
+
+// Same as `MakeShared` for arrays, but the elements are default-initialized: buffers of
+// trivial types are left untouched instead of being zeroed
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/make_shared
+template <typename T, typename Policy = DefaultLockPolicy,
+          size_t Alignment = kSharedArrayAlignment>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T, Policy> MakeSharedForOverwrite(size_t size) {
+    return MakeSharedArray<T, Policy, Alignment>(size, true);
+}
+template <typename T, typename Policy = DefaultLockPolicy,
+          size_t Alignment = kSharedArrayAlignment>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T, Policy> MakeSharedForOverwrite() {
+    return MakeSharedArray<T, Policy, Alignment>(std::extent_v<T>, true);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bulk reference counting
+
+template <typename Block>
+concept BulkRelease = requires(Block* block, size_t count) { block->MinusCounter(count); };
+
+// One combined decrement where the block supports it
+template <typename Policy>
+void MinusCounters(ControlBlock<Policy>* block, size_t count) {
+    if constexpr (BulkRelease<ControlBlock<Policy>>) {
+        block->MinusCounter(count);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            block->MinusCounter();
+        }
+    }
+}
+
+// Writes `n` copies of `ptr` to `out` with a single increment of the count. Returns the iterator
+// past the last copy. If writing a copy throws, the references not handed out yet are dropped.
+template <typename T, typename Policy, typename OutputIt>
+OutputIt ShareN(const SharedPtr<T, Policy>& ptr, size_t n, OutputIt out) {
+    if (ptr.block_ != nullptr && n != 0) {
+        ptr.block_->PlusCounter(n);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        // Adopts one of the references taken above
+        SharedPtr<T, Policy> copy;
+        copy.ptr_ = ptr.ptr_;
+        copy.block_ = ptr.block_;
+        try {
+            *out = std::move(copy);
+        } catch (...) {
+            if (ptr.block_ != nullptr && n - i > 1) {
+                MinusCounters(ptr.block_, n - i - 1);
+            }
+            throw;
+        }
+        ++out;
+    }
+    return out;
+}
+
+// Empties every pointer of `ptrs`, dropping the references to each control block with one
+// combined decrement. The blocks are grouped in batches of `kReleaseAllBatch` pointers, so runs
+// of one block anywhere inside a batch are merged. `BiasedPolicy` blocks are released one by one.
+inline constexpr size_t kReleaseAllBatch = 256;
+
+template <typename T, typename Policy>
+void ReleaseAll(std::span<SharedPtr<T, Policy>> ptrs) {
+    std::array<ControlBlock<Policy>*, kReleaseAllBatch> blocks;
+    for (size_t begin = 0; begin < ptrs.size(); begin += kReleaseAllBatch) {
+        size_t size = std::min(kReleaseAllBatch, ptrs.size() - begin);
+        for (size_t i = 0; i < size; ++i) {
+            SharedPtr<T, Policy>& ptr = ptrs[begin + i];
+            blocks[i] = std::exchange(ptr.block_, nullptr);
+            ptr.ptr_ = nullptr;
+        }
+        std::sort(blocks.begin(), blocks.begin() + size, std::less<ControlBlock<Policy>*>());
+        for (size_t i = 0; i < size;) {
+            size_t run = 1;
+            while (i + run < size && blocks[i + run] == blocks[i]) {
+                ++run;
+            }
+            if (blocks[i] != nullptr) {
+                MinusCounters(blocks[i], run);
+            }
+            i += run;
+        }
+    }
+}
+
+// Releases and clears the vector
+template <typename T, typename Policy, typename Alloc>
+void ReleaseAll(std::vector<SharedPtr<T, Policy>, Alloc>& ptrs) {
+    ReleaseAll(std::span<SharedPtr<T, Policy>>(ptrs));
+    ptrs.clear();
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Generational slot map, an alternative to `SharedPtr` + `WeakPtr` for tables of entities where
+// the weak pointers only serve to detect dangling references.
+//
+// `SlotMap<T>` owns its values in one dense array, so iterating over all live values is a linear
+// scan, and there are no per-object control blocks. A value is referred to by an 8-byte
+// `SlotHandle<T>`: a slot index and the generation of the slot when the value was inserted.
+// Erasing a value bumps the generation, so every handle to it goes stale, and puts the slot on a
+// free list for reuse. Lookups and validity checks are two array accesses and a compare.
+//
+// Erasing moves the last value into the hole, so the order of iteration changes and pointers and
+// references into the map stay valid only until the next insertion or erasure; handles stay
+// valid until their own value is erased.
+//
+// `SlotMapImporter<T, Policy>` moves objects owned through `SharedPtr` into a map and translates
+// the `WeakPtr`s that still refer to them into handles, for code migrating piece by piece.
+//
+// Usage:
+//     SlotMap<Entity> entities;
+//     SlotHandle<Entity> player = entities.Insert(...);
+//     if (Entity* entity = entities.Get(player)) { ... }
+//     for (Entity& entity : entities) { ... }
+//     entities.Erase(player);                       // `Get(player)` is nullptr from now on
+template <typename T>
+struct SlotHandle {
+    uint32_t index = 0;
+    // Odd while the slot holds the value, 0 for a null handle
+    uint32_t generation = 0;
+
+    explicit operator bool() const {
+        return generation != 0;
+    }
+    bool operator==(const SlotHandle&) const = default;
+
+    // For storing handles in untyped form
+    uint64_t ToBits() const {
+        return uint64_t{generation} << 32 | index;
+    }
+    static SlotHandle FromBits(uint64_t bits) {
+        return {static_cast<uint32_t>(bits), static_cast<uint32_t>(bits >> 32)};
+    }
+};
+
+template <typename T>
+struct std::hash<SlotHandle<T>> {
+    size_t operator()(const SlotHandle<T>& handle) const {
+        return std::hash<uint64_t>()(handle.ToBits());
+    }
+};
+
+template <typename T>
+class SlotMap {
+public:
+    using Handle = SlotHandle<T>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    template <typename... Args>
+    Handle Insert(Args&&... args) {
+        if (values_.size() == kMaxSize) {
+            throw std::length_error("SlotMap is full");
+        }
+        // Grows everything first, so a throw leaves the map as it was
+        if (free_head_ == kNoSlot) {
+            Grow(slots_);
+        }
+        Grow(owners_);
+        values_.emplace_back(std::forward<Args>(args)...);
+
+        uint32_t index = free_head_;
+        if (index == kNoSlot) {
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.push_back({kNoSlot, 0});
+        }
+        Slot& slot = slots_[index];
+        free_head_ = slot.dense;
+        owners_.push_back(index);
+        slot.dense = static_cast<uint32_t>(values_.size() - 1);
+        ++slot.generation;
+        return {index, slot.generation};
+    }
+
+    // Returns false if the handle was stale
+    bool Erase(Handle handle) {
+        if (!Contains(handle)) {
+            return false;
+        }
+        Slot& slot = slots_[handle.index];
+        uint32_t dense = slot.dense;
+        if (dense != values_.size() - 1) {
+            values_[dense] = std::move(values_.back());
+            owners_[dense] = owners_.back();
+            slots_[owners_[dense]].dense = dense;
+        }
+        values_.pop_back();
+        owners_.pop_back();
+        // A slot whose generation would wrap around is retired for good
+        if (++slot.generation != kLastGeneration) {
+            slot.dense = free_head_;
+            free_head_ = handle.index;
+        }
+        return true;
+    }
+
+    void Clear() {
+        for (uint32_t index : owners_) {
+            Slot& slot = slots_[index];
+            if (++slot.generation != kLastGeneration) {
+                slot.dense = free_head_;
+                free_head_ = index;
+            }
+        }
+        values_.clear();
+        owners_.clear();
+    }
+
+    void Reserve(size_t size) {
+        values_.reserve(size);
+        owners_.reserve(size);
+        slots_.reserve(size);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    bool Contains(Handle handle) const {
+        return (handle.generation & 1) != 0 && handle.index < slots_.size() &&
+               slots_[handle.index].generation == handle.generation;
+    }
+    // nullptr if the value was erased
+    T* Get(Handle handle) {
+        return const_cast<T*>(std::as_const(*this).Get(handle));
+    }
+    const T* Get(Handle handle) const {
+        // Every slot in `slots_` has been filled at least once, so a null handle never matches
+        if (handle.index >= slots_.size()) {
+            return nullptr;
+        }
+        const Slot& slot = slots_[handle.index];
+        return slot.generation == handle.generation && (slot.generation & 1) != 0
+                   ? &values_[slot.dense]
+                   : nullptr;
+    }
+
+    // The handle of the value at `position` of the iteration order
+    Handle HandleAt(size_t position) const {
+        uint32_t index = owners_[position];
+        return {index, slots_[index].generation};
+    }
+
+    size_t Size() const {
+        return values_.size();
+    }
+    bool Empty() const {
+        return values_.empty();
+    }
+
+    // Dense iteration over the live values
+    T* begin() {
+        return values_.data();
+    }
+    T* end() {
+        return values_.data() + values_.size();
+    }
+    const T* begin() const {
+        return values_.data();
+    }
+    const T* end() const {
+        return values_.data() + values_.size();
+    }
+
+private:
+    static constexpr uint32_t kNoSlot = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t kLastGeneration = std::numeric_limits<uint32_t>::max() - 1;
+    static constexpr size_t kMaxSize = kNoSlot;
+
+    struct Slot {
+        // Position of the value in `values_`, or the next free slot while the slot is free
+        uint32_t dense;
+        uint32_t generation;
+    };
+
+    // Makes room for one more element, doubling the capacity like `push_back` would
+    template <typename U>
+    static void Grow(std::vector<U>& vector) {
+        if (vector.size() == vector.capacity()) {
+            vector.reserve(std::max<size_t>(1, 2 * vector.capacity()));
+        }
+    }
+
+    std::vector<T> values_;
+    // Slot of each value in `values_`
+    std::vector<uint32_t> owners_;
+    std::vector<Slot> slots_;
+    uint32_t free_head_ = kNoSlot;
+};
+
+// Migration helper from `SharedPtr`-owned objects to a `SlotMap`
+template <typename T, typename Policy = DefaultLockPolicy>
+class SlotMapImporter {
+public:
+    using Handle = SlotHandle<T>;
+
+    explicit SlotMapImporter(SlotMap<T>& map) : map_(&map) {
+    }
+
+    // Moves the object out of `owner` into the map and releases `owner`. Other `SharedPtr`s to
+    // it are left with a moved-from object, `WeakPtr`s to it translate to the new handle.
+    // An empty `owner` imports nothing and gives a null handle.
+    Handle Import(SharedPtr<T, Policy>&& owner) {
+        if (!owner) {
+            return {};
+        }
+        Handle handle = map_->Insert(std::move(*owner));
+        handles_.insert_or_assign(WeakPtr<T, Policy>(owner), handle);
+        owner.Reset();
+        return handle;
+    }
+
+    // The handle of an imported object, a null handle if it was never imported. A `WeakPtr` that
+    // expired after the import still translates.
+    Handle Translate(const WeakPtr<T, Policy>& weak) const {
+        auto it = handles_.find(weak);
+        return it != handles_.end() ? it->second : Handle{};
+    }
+
+    // Drops the translations, and with them the control blocks they kept alive
+    void Clear() {
+        handles_.clear();
+    }
+
+private:
+    SlotMap<T>* map_;
+    // Keyed by control block, the key keeps the block and thus its address
+    std::unordered_map<WeakPtr<T, Policy>, Handle, OwnerHasher, OwnerEqualTo> handles_;
+};
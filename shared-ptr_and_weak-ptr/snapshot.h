@@ -0,0 +1,261 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Read-mostly publication with epoch-based reclamation (Fraser, "Practical lock-freedom", 5.2.3).
+// `Snapshot<T>` holds the current version of a value. Readers borrow it without touching any
+// reference counter: `Read()` announces the global epoch in a cache line of the reading thread
+// and returns a guard that dereferences to `const T&`. Writers `Publish()` a new `SharedPtr<T>`;
+// the replaced version is retired and only released once every reader that could still see it
+// has left, which the writer detects by advancing the global epoch.
+//
+// The global epoch moves from `e` to `e + 1` only when no reader is inside an older epoch, so a
+// version retired during epoch `e` is unreachable once the epoch reaches `e + 2`. Readers never
+// wait and only write the cache line of their own thread; a reader that stays inside a guard only
+// delays the release of old versions.
+//
+// Every thread that reads gets a record in `EpochDomain`'s list on its first `Read()`. The record
+// is reused by a later thread once its thread exits, and is never freed.
+//
+// Usage:
+//     Snapshot<Config> config(MakeShared<Config, AtomicPolicy>(...));
+//     {
+//         auto current = config.Read();     // no counter updates
+//         Lookup(current->table, key);
+//     }
+//     config.Publish(MakeShared<Config, AtomicPolicy>(...));
+class EpochDomain {
+public:
+    class Guard;
+
+    // Epochs start at 1, 0 marks a thread outside any guard
+    static constexpr uint64_t kQuiescent = 0;
+
+    // Enters the current epoch, nested guards keep the outermost one's
+    static Guard Enter();
+
+    static uint64_t Epoch() {
+        return epoch_.load(std::memory_order_seq_cst);
+    }
+
+    // Moves the global epoch one step forward unless some reader is still inside an older one.
+    // Returns the epoch after the attempt.
+    static uint64_t TryAdvance() {
+        uint64_t epoch = Epoch();
+        for (Record* record = records_.load(std::memory_order_acquire); record != nullptr;
+             record = record->next) {
+            uint64_t local = record->epoch.load(std::memory_order_seq_cst);
+            if (local != kQuiescent && local != epoch) {
+                return epoch;
+            }
+        }
+        epoch_.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+        return Epoch();
+    }
+
+    // True if a version retired in epoch `retired` is out of every reader's hands at `epoch`
+    static bool Expired(uint64_t retired, uint64_t epoch) {
+        return epoch - retired >= 2;
+    }
+
+private:
+    struct alignas(64) Record {
+        std::atomic<uint64_t> epoch{kQuiescent};
+        std::atomic<bool> in_use{true};
+        // Only touched by the owning thread
+        size_t nesting = 0;
+        Record* next = nullptr;
+    };
+
+    // Hands the record back to the list when its thread exits
+    struct ThreadRecord {
+        Record* record = Acquire();
+
+        ~ThreadRecord() {
+            record->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    static Record* Acquire() {
+        for (Record* record = records_.load(std::memory_order_acquire); record != nullptr;
+             record = record->next) {
+            bool free = false;
+            if (!record->in_use.load(std::memory_order_relaxed) &&
+                record->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        auto record = new Record;
+        record->next = records_.load(std::memory_order_relaxed);
+        while (!records_.compare_exchange_weak(record->next, record, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+        return record;
+    }
+
+    static Record* ThisThread() {
+        thread_local ThreadRecord record;
+        return record.record;
+    }
+
+    static inline std::atomic<uint64_t> epoch_{1};
+    static inline std::atomic<Record*> records_{nullptr};
+};
+
+// Keeps the thread inside an epoch, see above
+class EpochDomain::Guard {
+public:
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+    ~Guard() {
+        if (--record_->nesting == 0) {
+            record_->epoch.store(kQuiescent, std::memory_order_release);
+        }
+    }
+
+private:
+    friend class EpochDomain;
+
+    explicit Guard(Record* record) : record_(record) {
+        if (record_->nesting++ == 0) {
+            // A seq_cst read-modify-write rather than a store and a fence: it orders the
+            // announcement before the reader's loads of published pointers in a way TSan sees
+            record_->epoch.exchange(epoch_.load(std::memory_order_relaxed),
+                                    std::memory_order_seq_cst);
+        }
+    }
+
+    Record* record_;
+};
+
+inline EpochDomain::Guard EpochDomain::Enter() {
+    return Guard(ThisThread());
+}
+
+template <typename T, typename Policy = AtomicPolicy>
+class Snapshot {
+    static_assert(!std::is_same_v<Policy, SingleThreadedPolicy>,
+                  "Snapshot needs a thread-safe locking policy");
+
+    using Version = SharedPtr<T, Policy>;
+
+    struct Retired {
+        uint64_t epoch;
+        Version* version;
+    };
+
+public:
+    // Borrowed access to the version current at `Read()`, valid while the guard lives.
+    // Must be destroyed on the thread that created it.
+    class ReadGuard {
+    public:
+        const T* Get() const {
+            return version_->Get();
+        }
+        const T& operator*() const {
+            return **version_;
+        }
+        const T* operator->() const {
+            return version_->Get();
+        }
+        explicit operator bool() const {
+            return static_cast<bool>(*version_);
+        }
+        // A counted reference that outlives the guard
+        SharedPtr<T, Policy> Share() const {
+            return *version_;
+        }
+
+    private:
+        friend class Snapshot;
+
+        explicit ReadGuard(const std::atomic<Version*>& current)
+            : guard_(EpochDomain::Enter()), version_(current.load(std::memory_order_seq_cst)) {
+        }
+
+        EpochDomain::Guard guard_;
+        const Version* version_;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    explicit Snapshot(SharedPtr<T, Policy> initial = nullptr)
+        : current_(new Version(std::move(initial))) {
+    }
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    // No reader may be inside `Read()` any more
+    ~Snapshot() {
+        delete current_.load(std::memory_order_relaxed);
+        for (Retired& retired : retired_) {
+            delete retired.version;
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Readers
+
+    ReadGuard Read() const {
+        return ReadGuard(current_);
+    }
+
+    // The current version as a counted pointer
+    SharedPtr<T, Policy> Load() const {
+        return Read().Share();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Writers
+
+    // Replaces the current version. Writers are serialized, readers are never blocked.
+    void Publish(SharedPtr<T, Policy> next) {
+        auto version = new Version(std::move(next));
+        std::lock_guard guard(mutex_);
+        Version* old = current_.exchange(version, std::memory_order_seq_cst);
+        retired_.push_back({EpochDomain::Epoch(), old});
+        ReclaimLocked();
+    }
+
+    // Releases the retired versions no reader can see any more. Returns how many are left.
+    size_t Reclaim() {
+        std::lock_guard guard(mutex_);
+        ReclaimLocked();
+        return retired_.size();
+    }
+
+private:
+    void ReclaimLocked() {
+        // Two steps release a version retired just now if no reader is inside a guard
+        EpochDomain::TryAdvance();
+        uint64_t epoch = EpochDomain::TryAdvance();
+        size_t kept = 0;
+        for (Retired& retired : retired_) {
+            if (EpochDomain::Expired(retired.epoch, epoch)) {
+                delete retired.version;
+            } else {
+                retired_[kept++] = retired;
+            }
+        }
+        retired_.resize(kept);
+    }
+
+    std::atomic<Version*> current_;
+    std::mutex mutex_;
+    // Oldest first
+    std::vector<Retired> retired_;
+};
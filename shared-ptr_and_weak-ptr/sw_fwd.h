@@ -1,81 +1,358 @@
 #pragma once
 
+#include "../common/instrumentation.h"
+#include "deferred.h"
+#include "policy.h"
+#include "pool.h"
+
+#include <algorithm>
 #include <exception>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+template <typename Policy>
+struct ControlBlock;
+
+// What the last references do with a block, resolved at compile time for each block type:
+// `destroy_object` runs when the strong count drops to zero, `free_block` when the weak count does.
+// A pointer to a static table replaces the vptr and keeps the calls out of every other path.
+template <typename Policy>
+struct ControlBlockOps {
+    void (*destroy_object)(ControlBlock<Policy>*);
+    void (*free_block)(ControlBlock<Policy>*);
+};
+
+// The table of `Block`, which implements `DeleteFromCounter` and `DeleteFromWeakCounter`
+template <typename Block, typename Policy>
+inline constexpr ControlBlockOps<Policy> kControlBlockOps{
+    [](ControlBlock<Policy>* block) { static_cast<Block*>(block)->DeleteFromCounter(); },
+    [](ControlBlock<Policy>* block) { static_cast<Block*>(block)->DeleteFromWeakCounter(); }};
 
-struct ControlBlock {
-    size_t counter = 1;
-    size_t weak_counter = 0;
-    virtual ~ControlBlock() = default;
-    virtual void DeleteFromCounter() = 0;
-    virtual void DeleteFromWeakCounter() = 0;
+// Control blocks are allocated from `ControlBlockPool` unless an allocator is given.
+// In deferred mode they also carry the link of the deferred queue, see deferred.h.
+//
+// The header is the ops pointer and one counts word, 16 bytes. All strong references together
+// hold one weak reference, so the block is released exactly once by whichever count reaches zero
+// last. Packing both counts lets the last owner see in one load that nobody else, not even a
+// `WeakPtr`, refers to the block and replace the atomic update by a plain store.
+template <typename Policy = DefaultLockPolicy>
+struct ControlBlock
+    : PoolAllocated,
+      std::conditional_t<DeferredDestruction<Policy>, DeferredNode, NotDeferred> {
+    const ControlBlockOps<Policy>* ops;
+    typename Policy::Counts counts{PackedCounts::kSoleOwner};
+    // Empty unless built with `SMART_PTRS_INSTRUMENTATION`
+    [[no_unique_address]] StatsHandle stats;
+
+    explicit ControlBlock(const ControlBlockOps<Policy>* block_ops) : ops(block_ops) {
+        if constexpr (DeferredDestruction<Policy>) {
+            this->reclaim = [](DeferredNode* node) { static_cast<ControlBlock*>(node)->Reclaim(); };
+        }
+    }
+
+    // Called by the derived block once the object is constructed
+    template <typename T>
+    void Instrument() {
+        stats = StatsHandle::For<T>();
+        stats.OnCreate();
+    }
 
-    void PlusCounter() {
-        ++counter;
+    // `count` references at once for fan-out, see `ShareN`
+    void PlusCounter(size_t count = 1) {
+        stats.OnStrongIncrement(count);
+        Policy::Add(counts, count * PackedCounts::kStrong);
     }
     void PlusWeakCounter() {
-        ++weak_counter;
+        stats.OnWeakIncrement();
+        Policy::Add(counts, PackedCounts::kWeak);
+    }
+    // Promotes a weak reference, fails once the object is gone
+    bool TryPlusCounter() {
+        if (!Policy::AddStrongIfNonZero(counts)) {
+            return false;
+        }
+        stats.OnStrongIncrement();
+        return true;
     }
     void MinusCounter() {
-        if (counter == 1) {
-            DeleteFromCounter();
+        uint64_t old = PackedCounts::kSoleOwner;
+        if (Policy::Load(counts) == old) {
+            // Still a store rather than nothing: the destructor must see the object as expired
+            Policy::Store(counts, PackedCounts::kWeak);
+        } else {
+            old = Policy::Subtract(counts, PackedCounts::kStrong);
+            if (PackedCounts::Strong(old) != 1) {
+                return;
+            }
         }
-        --counter;
-        if (counter == 0 && weak_counter == 0) {
-            DeleteFromWeakCounter();
+        ReleaseObject(old);
+    }
+    // Drops `count` references with one update, see `ReleaseAll`
+    void MinusCounter(size_t count) {
+        uint64_t old = Policy::Subtract(counts, count * PackedCounts::kStrong);
+        if (PackedCounts::Strong(old) == count) {
+            ReleaseObject(old);
         }
     }
+    void Reclaim() {
+        stats.OnDestroyObject();
+        ops->destroy_object(this);
+        MinusWeakCounter();
+    }
     size_t GetCounter() {
-        return counter;
+        return PackedCounts::Strong(Policy::Load(counts));
     }
     void MinusWeakCounter() {
-        --weak_counter;
-        if (counter + weak_counter == 0) {
-            DeleteFromWeakCounter();
+        if (Policy::Load(counts) == PackedCounts::kWeak ||
+            PackedCounts::Weak(Policy::Subtract(counts, PackedCounts::kWeak)) == 1) {
+            ops->free_block(this);
+        }
+    }
+
+protected:
+    // Blocks are destroyed through `ops->free_block` only, by their own type
+    ~ControlBlock() {
+        stats.OnFreeBlock();
+    }
+
+private:
+    // The last strong reference is gone, `old` is the word before it was dropped
+    void ReleaseObject(uint64_t old) {
+        if constexpr (DeferredDestruction<Policy>) {
+            DeferredQueue::Push(this);
+        } else {
+            stats.OnDestroyObject();
+            ops->destroy_object(this);
+            // Nobody could have taken a weak reference since, no need to drop ours atomically
+            if (PackedCounts::Weak(old) == 1) {
+                ops->free_block(this);
+            } else {
+                MinusWeakCounter();
+            }
         }
     }
 };
 
-template <typename T>
-struct ControlBlockPointer : ControlBlock {
-    T* ptr;
-    ~ControlBlockPointer() override = default;
+#ifndef SMART_PTRS_INSTRUMENTATION
+// The ops pointer and the packed word, nothing else
+static_assert(sizeof(ControlBlock<SingleThreadedPolicy>) == sizeof(void*) + sizeof(uint64_t));
+static_assert(sizeof(ControlBlock<AtomicPolicy>) == sizeof(void*) + sizeof(uint64_t));
+#endif
 
-    ControlBlockPointer(T* p) : ptr(p){};
+template <typename T, typename Policy = DefaultLockPolicy>
+struct ControlBlockPointer : ControlBlock<Policy> {
+    // `T[]` owns an array allocated with `new[]`
+    std::remove_extent_t<T>* ptr;
 
-    void DeleteFromCounter() override {
+    ControlBlockPointer(std::remove_extent_t<T>* p)
+        : ControlBlock<Policy>(&kControlBlockOps<ControlBlockPointer, Policy>), ptr(p) {
+        this->template Instrument<std::remove_extent_t<T>>();
+    };
+
+    void DeleteFromCounter() {
         auto obj = ptr;
         ptr = nullptr;
-        delete obj;
+        if constexpr (std::is_array_v<T>) {
+            delete[] obj;
+        } else {
+            delete obj;
+        }
     }
-    void DeleteFromWeakCounter() override {
+    void DeleteFromWeakCounter() {
         delete this;
     }
 };
-template <typename T>
-struct ControlBlockAllocator : ControlBlock {
-    ~ControlBlockAllocator() override = default;
+template <typename T, typename Policy = DefaultLockPolicy>
+struct ControlBlockAllocator : ControlBlock<Policy> {
     alignas(T) std::byte block[sizeof(T)];
     template <typename... Args>
-    ControlBlockAllocator(Args&&... args) {
-        new (&block) T(std::forward<Args>(args)...);
+    ControlBlockAllocator(Args&&... args)
+        : ControlBlock<Policy>(&kControlBlockOps<ControlBlockAllocator, Policy>) {
+        ::new (static_cast<void*>(&block)) T(std::forward<Args>(args)...);
+        this->template Instrument<T>();
     }
     T* GetPtr() {
         return reinterpret_cast<T*>(&block);
     }
-    void DeleteFromCounter() override {
+    // The inverse of `GetPtr()`, the object sits at the same offset in every such block
+    static ControlBlockAllocator* FromPtr(T* ptr) {
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+// No virtual bases, so the offset is well defined in practice
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+#endif
+        constexpr size_t kOffset = offsetof(ControlBlockAllocator, block);
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+        auto object = reinterpret_cast<std::byte*>(ptr);
+        return reinterpret_cast<ControlBlockAllocator*>(object - kOffset);
+    }
+    void DeleteFromCounter() {
         GetPtr()->~T();
     }
-    void DeleteFromWeakCounter() override {
+    void DeleteFromWeakCounter() {
         delete this;
     }
 };
 
+// `MakeShared` keeps objects larger than this out of line, in an allocation of their own that is
+// returned as soon as the last strong reference goes. An inline object pins its memory until
+// the last `WeakPtr` is gone as well.
+inline constexpr size_t kMakeSharedInlineLimit = 4096;
+
+// Control block for `MakeShared` of large objects: the block allocates the object itself and
+// frees it together with the destructor, the block alone stays behind for the weak references.
+template <typename T, typename Policy = DefaultLockPolicy>
+struct ControlBlockOutOfLine : ControlBlock<Policy> {
+    T* ptr;
+    template <typename... Args>
+    ControlBlockOutOfLine(Args&&... args)
+        : ControlBlock<Policy>(&kControlBlockOps<ControlBlockOutOfLine, Policy>),
+          ptr(new T(std::forward<Args>(args)...)) {
+        this->template Instrument<T>();
+    }
+    T* GetPtr() {
+        return ptr;
+    }
+    void DeleteFromCounter() {
+        auto obj = ptr;
+        ptr = nullptr;
+        delete obj;
+    }
+    void DeleteFromWeakCounter() {
+        delete this;
+    }
+};
+
+// Control block for `AllocateShared`: the object and the block share one allocation obtained
+// from `Alloc`, which also constructs and destroys the object.
+template <typename T, typename Alloc, typename Policy = DefaultLockPolicy>
+struct ControlBlockAllocated : ControlBlock<Policy> {
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockAllocated>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+    using ValueAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+    using ValueTraits = std::allocator_traits<ValueAlloc>;
+
+    alignas(T) std::byte block[sizeof(T)];
+    [[no_unique_address]] BlockAlloc alloc;
+
+    template <typename... Args>
+    static ControlBlockAllocated* Create(const Alloc& a, Args&&... args) {
+        BlockAlloc block_alloc(a);
+        ControlBlockAllocated* memory = BlockTraits::allocate(block_alloc, 1);
+        try {
+            return ::new (static_cast<void*>(memory))
+                ControlBlockAllocated(block_alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, memory, 1);
+            throw;
+        }
+    }
+
+    T* GetPtr() {
+        return reinterpret_cast<T*>(&block);
+    }
+    void DeleteFromCounter() {
+        ValueAlloc value_alloc(alloc);
+        ValueTraits::destroy(value_alloc, GetPtr());
+    }
+    void DeleteFromWeakCounter() {
+        BlockAlloc block_alloc(std::move(alloc));
+        this->~ControlBlockAllocated();
+        BlockTraits::deallocate(block_alloc, this, 1);
+    }
+
+private:
+    template <typename... Args>
+    ControlBlockAllocated(const BlockAlloc& a, Args&&... args)
+        : ControlBlock<Policy>(&kControlBlockOps<ControlBlockAllocated, Policy>), alloc(a) {
+        ValueAlloc value_alloc(alloc);
+        ValueTraits::construct(value_alloc, GetPtr(), std::forward<Args>(args)...);
+        this->template Instrument<T>();
+    }
+};
+
+// Default alignment of `MakeShared<T[]>` elements: a cache line, and the widest SIMD register
+inline constexpr size_t kSharedArrayAlignment = 64;
+
+// Control block for `MakeShared<T[]>`: one allocation holds the block followed by `size`
+// elements starting at the first `Alignment` boundary.
+template <typename T, typename Policy = DefaultLockPolicy,
+          size_t Alignment = kSharedArrayAlignment>
+struct ControlBlockArray : ControlBlock<Policy> {
+    static_assert(!std::is_array_v<T>, "Multidimensional arrays are not supported");
+    static_assert((Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two");
+
+    size_t size;
+
+    // Default-initializes the elements if `for_overwrite`, value-initializes them otherwise
+    static ControlBlockArray* Create(size_t size, bool for_overwrite) {
+        if (size > (SIZE_MAX - HeaderSize()) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* memory = ::operator new(AllocationSize(size), std::align_val_t{BlockAlignment()});
+        auto block = ::new (memory) ControlBlockArray(size);
+        try {
+            if (for_overwrite) {
+                std::uninitialized_default_construct_n(block->GetPtr(), size);
+            } else {
+                std::uninitialized_value_construct_n(block->GetPtr(), size);
+            }
+        } catch (...) {
+            block->Deallocate();
+            throw;
+        }
+        block->template Instrument<T>();
+        return block;
+    }
+
+    T* GetPtr() {
+        return reinterpret_cast<T*>(reinterpret_cast<std::byte*>(this) + HeaderSize());
+    }
+    void DeleteFromCounter() {
+        std::destroy_n(GetPtr(), size);
+    }
+    void DeleteFromWeakCounter() {
+        Deallocate();
+    }
+
+private:
+    explicit ControlBlockArray(size_t n)
+        : ControlBlock<Policy>(&kControlBlockOps<ControlBlockArray, Policy>), size(n) {
+    }
+
+    static constexpr size_t ElementAlignment() {
+        return std::max(Alignment, alignof(T));
+    }
+    static constexpr size_t BlockAlignment() {
+        return std::max(ElementAlignment(), alignof(ControlBlockArray));
+    }
+    static constexpr size_t HeaderSize() {
+        return (sizeof(ControlBlockArray) + ElementAlignment() - 1) / ElementAlignment() *
+               ElementAlignment();
+    }
+    static size_t AllocationSize(size_t size) {
+        return HeaderSize() + size * sizeof(T);
+    }
+
+    void Deallocate() {
+        size_t bytes = AllocationSize(size);
+        this->~ControlBlockArray();
+        ::operator delete(static_cast<void*>(this), bytes, std::align_val_t{BlockAlignment()});
+    }
+};
+
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+template <typename T, typename Policy = DefaultLockPolicy>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Policy = DefaultLockPolicy>
 class WeakPtr;
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "atomic_shared.h"
+
+#include <optional>
+#include <utility>
+
+// Lock-free stack (R. K. Treiber, 1986) on top of `AtomicSharedPtr`. Reference counting keeps
+// popped nodes alive while other threads still look at them, which rules out both ABA and
+// use-after-free without hazard pointers.
+template <typename T>
+class TreiberStack {
+    struct Node {
+        T value;
+        SharedPtr<Node, AtomicPolicy> next;
+
+        explicit Node(T&& v) : value(std::move(v)) {
+        }
+    };
+
+    AtomicSharedPtr<Node> head_;
+
+public:
+    TreiberStack() = default;
+    TreiberStack(const TreiberStack&) = delete;
+    TreiberStack& operator=(const TreiberStack&) = delete;
+
+    // Pops one by one: dropping the whole chain at once would recurse through `next`
+    ~TreiberStack() {
+        while (Pop()) {
+        }
+    }
+
+    void Push(T value) {
+        auto node = MakeShared<Node, AtomicPolicy>(std::move(value));
+        node->next = head_.Load();
+        while (!head_.CompareExchange(node->next, node)) {
+        }
+    }
+
+    std::optional<T> Pop() {
+        auto node = head_.Load();
+        while (node && !head_.CompareExchange(node, node->next)) {
+        }
+        if (!node) {
+            return std::nullopt;
+        }
+        return std::move(node->value);
+    }
+
+    bool Empty() const {
+        return !head_.Load();
+    }
+};
@@ -1,22 +1,32 @@
 #pragma once
 
+#include "../common/relocation.h"
 #include "sw_fwd.h"  // Forward declaration
+#include <functional>
+#include <type_traits>
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Policy>
 class WeakPtr {
-    T* ptr_ = nullptr;
-    ControlBlock* block_ = nullptr;
+public:
+    using ElementType = std::remove_extent_t<T>;
 
-    template <typename Z>
+private:
+    ElementType* ptr_ = nullptr;
+    ControlBlock<Policy>* block_ = nullptr;
+
+    template <typename Z, typename P>
     friend class SharedPtr;
 
-    template <typename Z>
+    template <typename Z, typename P>
     friend class WeakPtr;
 
-    template <typename Z>
+    template <typename Z, typename P>
     friend class EnableSharedFromThis;
 
+    template <typename Z, typename P>
+    friend class EnableSharedFromThisInline;
+
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
@@ -24,7 +34,7 @@ public:
     WeakPtr() = default;
 
     template <typename Z>
-    WeakPtr(const WeakPtr<Z>& other) : ptr_(other.ptr_), block_(other.block_) {
+    WeakPtr(const WeakPtr<Z, Policy>& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_ != nullptr) {
             block_->PlusWeakCounter();
         }
@@ -36,19 +46,19 @@ public:
         }
     };
     template <typename Z>
-    WeakPtr(WeakPtr<Z>&& other) : ptr_(other.ptr_), block_(other.block_) {
+    WeakPtr(WeakPtr<Z, Policy>&& other) noexcept : ptr_(other.ptr_), block_(other.block_) {
         other.ptr_ = nullptr;
         other.block_ = nullptr;
     };
 
-    WeakPtr(WeakPtr&& other) : ptr_(other.ptr_), block_(other.block_) {
+    WeakPtr(WeakPtr&& other) noexcept : ptr_(other.ptr_), block_(other.block_) {
         other.ptr_ = nullptr;
         other.block_ = nullptr;
     };
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) : ptr_(other.Get()), block_(other.GetBlock()) {
+    WeakPtr(const SharedPtr<T, Policy>& other) : ptr_(other.Get()), block_(other.GetBlock()) {
         if (block_ != nullptr) {
             block_->PlusWeakCounter();
         }
@@ -56,54 +66,24 @@ public:
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
-    template <typename Z>
-    WeakPtr& operator=(const WeakPtr<Z>& other) {
-        if (this->ptr_ != other.ptr_) {
-            Reset();
-            ptr_ = other.ptr_;
-            block_ = other.block_;
-
-            if (block_ != nullptr) {
-                block_->PlusWeakCounter();
-            }
-        }
+    WeakPtr& operator=(const WeakPtr& other) {
+        WeakPtr(other).Swap(*this);
         return *this;
-    };
-    template <typename Z>
-    WeakPtr& operator=(WeakPtr<Z>&& other) {
-        if (this->ptr_ != other.ptr_) {
-            Reset();
-            ptr_ = other.ptr_;
-            block_ = other.block_;
-            other.ptr_ = nullptr;
-            other.block_ = nullptr;
-        }
+    }
+    WeakPtr& operator=(WeakPtr&& other) noexcept {
+        WeakPtr(std::move(other)).Swap(*this);
         return *this;
-    };
-    WeakPtr& operator=(WeakPtr&& other) {
-        if (this->ptr_ != other.ptr_) {
-            Reset();
-            ptr_ = other.ptr_;
-            block_ = other.block_;
-            other.ptr_ = nullptr;
-            other.block_ = nullptr;
-        }
+    }
+    template <typename Z>
+    WeakPtr& operator=(const WeakPtr<Z, Policy>& other) {
+        WeakPtr(other).Swap(*this);
         return *this;
-    };
-
+    }
     template <typename Z>
-    WeakPtr& operator=(WeakPtr<Z>& other) {
-        if (this->ptr_ != other.ptr_) {
-            Reset();
-            ptr_ = other.ptr_;
-            block_ = other.block_;
-
-            if (block_ != nullptr) {
-                block_->PlusWeakCounter();
-            }
-        }
+    WeakPtr& operator=(WeakPtr<Z, Policy>&& other) noexcept {
+        WeakPtr(std::move(other)).Swap(*this);
         return *this;
-    };
+    }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Destructor
@@ -122,7 +102,7 @@ public:
             block_ = nullptr;
         }
     };
-    void Swap(WeakPtr& other) {
+    void Swap(WeakPtr& other) noexcept {
         std::swap(ptr_, other.ptr_);
         std::swap(block_, other.block_);
     };
@@ -139,11 +119,68 @@ public:
     bool Expired() const {
         return UseCount() == 0;
     };
-    SharedPtr<T> Lock() const {
-        if (Expired()) {
-            return SharedPtr<T>();
-        } else {
-            return SharedPtr<T>(*this);
+    // Never throws, returns an empty pointer if the object is gone
+    SharedPtr<T, Policy> Lock() const noexcept {
+        SharedPtr<T, Policy> result;
+        if (block_ != nullptr && block_->TryPlusCounter()) {
+            result.ptr_ = ptr_;
+            result.block_ = block_;
         }
+        return result;
     };
+    // Borrowed pointer for a liveness check, nullptr if the object is gone. Does not keep the
+    // object alive: only dereference it while some `SharedPtr` is known to own it.
+    ElementType* TryLock() const noexcept {
+        return Expired() ? nullptr : ptr_;
+    };
+
+    // Same as the `SharedPtr` ones, valid after expiry
+    // https://en.cppreference.com/w/cpp/memory/weak_ptr/owner_before
+    template <typename Z>
+    bool OwnerBefore(const WeakPtr<Z, Policy>& other) const {
+        return std::less<ControlBlock<Policy>*>()(block_, other.block_);
+    }
+    template <typename Z>
+    bool OwnerBefore(const SharedPtr<Z, Policy>& other) const {
+        return std::less<ControlBlock<Policy>*>()(block_, other.block_);
+    }
+    template <typename Z>
+    bool OwnerEqual(const WeakPtr<Z, Policy>& other) const {
+        return block_ == other.block_;
+    }
+    template <typename Z>
+    bool OwnerEqual(const SharedPtr<Z, Policy>& other) const {
+        return block_ == other.block_;
+    }
+    size_t OwnerHash() const {
+        return std::hash<ControlBlock<Policy>*>()(block_);
+    }
+};
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<WeakPtr<T, Policy>> : std::true_type {};
+
+// Owner-based comparators for ordered and unordered containers keyed by `SharedPtr` or `WeakPtr`,
+// both kinds may be mixed in lookups
+// https://en.cppreference.com/w/cpp/memory/owner_less
+struct OwnerLess {
+    using is_transparent = void;
+    template <typename A, typename B>
+    bool operator()(const A& left, const B& right) const {
+        return left.OwnerBefore(right);
+    }
+};
+struct OwnerHasher {
+    using is_transparent = void;
+    template <typename A>
+    size_t operator()(const A& ptr) const {
+        return ptr.OwnerHash();
+    }
+};
+struct OwnerEqualTo {
+    using is_transparent = void;
+    template <typename A, typename B>
+    bool operator()(const A& left, const B& right) const {
+        return left.OwnerEqual(right);
+    }
 };
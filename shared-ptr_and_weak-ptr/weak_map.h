@@ -0,0 +1,189 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// Concurrent cache that hands out `SharedPtr<V>` but holds its values through `WeakPtr<V>` only,
+// so an entry expires as soon as the last client drops the value.
+//
+// Keys are spread over independently locked shards. Expired entries are removed
+//   * by the lookup that finds them,
+//   * a few at a time by every insertion into the same shard,
+//   * by `Sweep(budget)`, which walks all shards bucket by bucket and stops after `budget`
+//     entries or empty buckets, so it can run from a timer without stalling writers.
+// An expired entry only costs its control block: `MakeShared` objects above
+// `kMakeSharedInlineLimit` already gave their memory back.
+//
+// Values are shared across threads, so the policy must be thread safe; `AtomicPolicy` is the
+// default.
+//
+// Usage:
+//     WeakValueMap<std::string, Texture> cache;
+//     SharedPtr<Texture> texture = cache.FindOrCreate(path, [&] { return Load(path); });
+template <typename K, typename V, typename Policy = AtomicPolicy, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class WeakValueMap {
+public:
+    static constexpr size_t kDefaultShards = 16;
+    // Entries or empty buckets an insertion checks for expiry in its shard
+    static constexpr size_t kSweepOnInsert = 4;
+
+    // `shards` is rounded up to a power of two
+    explicit WeakValueMap(size_t shards = kDefaultShards)
+        : shard_count_(std::bit_ceil(std::max<size_t>(shards, 1))),
+          shards_(std::make_unique<Shard[]>(shard_count_)) {
+    }
+
+    WeakValueMap(const WeakValueMap&) = delete;
+    WeakValueMap& operator=(const WeakValueMap&) = delete;
+
+    // The live value of `key`, empty if there is none
+    SharedPtr<V, Policy> Find(const K& key) {
+        Shard& shard = ShardFor(key);
+        std::lock_guard guard(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return nullptr;
+        }
+        SharedPtr<V, Policy> value = it->second.Lock();
+        if (!value) {
+            shard.map.erase(it);
+        }
+        return value;
+    }
+
+    // Stores `value` unless `key` already has a live value. Returns the value the map holds.
+    SharedPtr<V, Policy> Insert(const K& key, const SharedPtr<V, Policy>& value) {
+        Shard& shard = ShardFor(key);
+        std::lock_guard guard(shard.mutex);
+        auto [it, inserted] = shard.map.try_emplace(key, value);
+        if (!inserted) {
+            if (SharedPtr<V, Policy> existing = it->second.Lock()) {
+                return existing;
+            }
+            it->second = value;
+        }
+        SweepShard(shard, kSweepOnInsert);
+        return value;
+    }
+
+    // The live value of `key`, or a new one from `factory()` stored under it. The factory runs
+    // under the shard lock, so concurrent callers create the value once; it must not use the map.
+    template <typename Factory>
+    SharedPtr<V, Policy> FindOrCreate(const K& key, Factory&& factory) {
+        Shard& shard = ShardFor(key);
+        std::lock_guard guard(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it != shard.map.end()) {
+            if (SharedPtr<V, Policy> existing = it->second.Lock()) {
+                return existing;
+            }
+        }
+        SharedPtr<V, Policy> value = std::forward<Factory>(factory)();
+        if (it != shard.map.end()) {
+            it->second = value;
+        } else {
+            shard.map.emplace(key, value);
+        }
+        SweepShard(shard, kSweepOnInsert);
+        return value;
+    }
+
+    // True if there was an entry, live or not
+    bool Erase(const K& key) {
+        Shard& shard = ShardFor(key);
+        std::lock_guard guard(shard.mutex);
+        return shard.map.erase(key) != 0;
+    }
+
+    // Checks up to `budget` entries or empty buckets, continuing where the previous call stopped,
+    // and removes the expired entries. Returns how many were removed.
+    size_t Sweep(size_t budget) {
+        size_t removed = 0;
+        size_t first = next_sweep_shard_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < shard_count_ && budget != 0; ++i) {
+            Shard& shard = shards_[(first + i) & (shard_count_ - 1)];
+            std::lock_guard guard(shard.mutex);
+            auto [examined, erased] = SweepShard(shard, budget);
+            budget -= std::min(examined, budget);
+            removed += erased;
+        }
+        return removed;
+    }
+
+    // Number of entries, including expired ones not removed yet
+    size_t Size() const {
+        size_t size = 0;
+        for (size_t i = 0; i < shard_count_; ++i) {
+            std::lock_guard guard(shards_[i].mutex);
+            size += shards_[i].map.size();
+        }
+        return size;
+    }
+
+private:
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<K, WeakPtr<V, Policy>, Hash, KeyEqual> map;
+        // Next bucket to sweep
+        size_t cursor = 0;
+    };
+
+    struct SweepResult {
+        size_t examined;
+        size_t erased;
+    };
+
+    Shard& ShardFor(const K& key) {
+        // Fibonacci hashing: the shard comes from the high bits, the bucket from the low ones
+        uint64_t hash = static_cast<uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ull;
+        return shards_[(hash >> 32) & (shard_count_ - 1)];
+    }
+
+    // Walks whole buckets from the shard's cursor until `budget` is spent or every bucket was
+    // visited once. Each entry examined costs one, and so does an empty bucket, so a sparse map
+    // does not turn a small budget into a scan of the whole table. The cursor survives rehashing
+    // as a plain bucket index.
+    //
+    // Local iterators cannot erase, so a bucket is walked with a map iterator from its first
+    // entry, found with one lookup. The standard libraries keep a bucket's entries adjacent in
+    // iteration order; if one did not, the walk would merely examine neighbouring entries instead.
+    static SweepResult SweepShard(Shard& shard, size_t budget) {
+        SweepResult result{0, 0};
+        size_t buckets = shard.map.bucket_count();
+        for (size_t visited = 0; visited < buckets && result.examined < budget; ++visited) {
+            size_t bucket = shard.cursor++ % buckets;
+            size_t size = shard.map.bucket_size(bucket);
+            if (size == 0) {
+                ++result.examined;
+                continue;
+            }
+            auto it = shard.map.find(shard.map.begin(bucket)->first);
+            for (; size != 0 && it != shard.map.end(); --size) {
+                ++result.examined;
+                if (it->second.Expired()) {
+                    it = shard.map.erase(it);
+                    ++result.erased;
+                } else {
+                    ++it;
+                }
+            }
+        }
+        return result;
+    }
+
+    size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<size_t> next_sweep_shard_{0};
+};
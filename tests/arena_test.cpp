@@ -0,0 +1,87 @@
+#include "harness.h"
+
+#include "arena.h"
+#include "weak.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+struct Tracked {
+    static inline int live = 0;
+    int value;
+
+    explicit Tracked(int v = 0) : value(v) {
+        ++live;
+    }
+    ~Tracked() {
+        --live;
+    }
+};
+
+struct Point {
+    int x;
+    int y;
+};
+
+}  // namespace
+
+TEST(BumpAllocation) {
+    MonotonicArena arena(1024);
+    void* first = arena.Allocate(10, 1);
+    void* aligned = arena.Allocate(8, 64);
+    CHECK(reinterpret_cast<uintptr_t>(aligned) % 64 == 0);
+    CHECK(static_cast<std::byte*>(aligned) >= static_cast<std::byte*>(first) + 10);
+    CHECK(arena.BytesAllocated() == 18);
+    // Larger than a chunk, gets one of its own
+    void* big = arena.Allocate(4096, 16);
+    CHECK(big != nullptr);
+    CHECK(arena.BytesAllocated() == 18 + 4096);
+    arena.Reset();
+    CHECK(arena.BytesAllocated() == 0);
+    // The first chunk is kept and handed out again from the start
+    CHECK(arena.Allocate(10, 1) == first);
+}
+
+TEST(CountedObjectsInTheArena) {
+    MonotonicArena arena;
+    {
+        auto ptr = MakeShared<Tracked>(arena, 3);
+        CHECK(ptr->value == 3);
+        CHECK(ptr.UseCount() == 1);
+        CHECK(arena.BytesAllocated() >= sizeof(Tracked));
+        WeakPtr<Tracked> weak(ptr);
+        auto copy = ptr;
+        ptr.Reset();
+        CHECK(weak.Lock() == copy);
+        copy.Reset();
+        // The destructor runs at the last release, the memory stays until `Reset()`
+        CHECK(Tracked::live == 0);
+        CHECK(weak.Expired());
+    }
+    size_t used = arena.BytesAllocated();
+    std::vector<SharedPtr<Tracked>> many;
+    for (int i = 0; i < 10000; ++i) {
+        many.push_back(MakeShared<Tracked>(arena, i));
+    }
+    CHECK(arena.BytesAllocated() > used);
+    CHECK(many[9999]->value == 9999);
+    many.clear();
+    CHECK(Tracked::live == 0);
+    arena.Reset();
+    CHECK(arena.BytesAllocated() == 0);
+}
+
+TEST(UncountedObjects) {
+    MonotonicArena arena;
+    auto point = MakeSharedUncounted<Point>(arena, 1, 2);
+    CHECK(point->x == 1);
+    CHECK(point->y == 2);
+    CHECK(point.UseCount() == 0);
+    CHECK(point.GetBlock() == nullptr);
+    auto copy = point;
+    CHECK(copy.Get() == point.Get());
+    CHECK(copy.UseCount() == 0);
+    CHECK(arena.BytesAllocated() == sizeof(Point));
+}
@@ -0,0 +1,125 @@
+#include "harness.h"
+
+#include "atomic_shared.h"
+#include "treiber_stack.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Tracked {
+    static inline std::atomic<int> live{0};
+    int value;
+
+    explicit Tracked(int v) : value(v) {
+        live.fetch_add(1);
+    }
+    ~Tracked() {
+        live.fetch_sub(1);
+    }
+};
+
+using Ptr = SharedPtr<Tracked, AtomicPolicy>;
+
+constexpr int kThreads = 4;
+
+}  // namespace
+
+TEST(LoadStoreExchange) {
+    {
+        AtomicSharedPtr<Tracked> atomic;
+        CHECK(!atomic.Load());
+        atomic.Store(MakeShared<Tracked, AtomicPolicy>(1));
+        CHECK(atomic.Load()->value == 1);
+        Ptr old = atomic.Exchange(MakeShared<Tracked, AtomicPolicy>(2));
+        CHECK(old->value == 1);
+        CHECK(old.UseCount() == 1);
+        CHECK(atomic.Load()->value == 2);
+    }
+    CHECK(Tracked::live.load() == 0);
+}
+
+TEST(CompareExchange) {
+    {
+        auto first = MakeShared<Tracked, AtomicPolicy>(1);
+        AtomicSharedPtr<Tracked> atomic(first);
+        Ptr expected;
+        CHECK(!atomic.CompareExchange(expected, MakeShared<Tracked, AtomicPolicy>(2)));
+        CHECK(expected == first);
+        CHECK(atomic.CompareExchange(expected, MakeShared<Tracked, AtomicPolicy>(3)));
+        CHECK(atomic.Load()->value == 3);
+        CHECK(first.UseCount() == 2);
+    }
+    CHECK(Tracked::live.load() == 0);
+}
+
+// Readers copying out of nodes that writers keep swapping out
+TEST(ConcurrentReadersAndWriters) {
+    {
+        AtomicSharedPtr<Tracked> atomic(MakeShared<Tracked, AtomicPolicy>(0));
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&atomic, i] {
+                for (int round = 0; round < 2000; ++round) {
+                    if ((round + i) % 2 == 0) {
+                        Ptr ptr = atomic.Load();
+                        CHECK(ptr && ptr->value >= 0);
+                    } else if (round % 3 == 0) {
+                        atomic.Store(MakeShared<Tracked, AtomicPolicy>(round));
+                    } else {
+                        Ptr expected = atomic.Load();
+                        atomic.CompareExchange(expected, MakeShared<Tracked, AtomicPolicy>(i));
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    CHECK(Tracked::live.load() == 0);
+}
+
+// Every pushed value is popped exactly once
+TEST(TreiberStackPushPop) {
+    constexpr int kPerThread = 2000;
+    TreiberStack<int> stack;
+    std::vector<std::vector<int>> popped(kThreads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        threads.emplace_back([&stack, &popped, i] {
+            for (int n = 0; n < kPerThread; ++n) {
+                stack.Push(i * kPerThread + n);
+                if (n % 2 == 1) {
+                    while (auto value = stack.Pop()) {
+                        popped[i].push_back(*value);
+                        if (popped[i].size() % 3 == 0) {
+                            break;
+                        }
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::vector<int> seen(kThreads * kPerThread, 0);
+    for (const auto& values : popped) {
+        for (int value : values) {
+            REQUIRE(value >= 0 && value < kThreads * kPerThread);
+            ++seen[value];
+        }
+    }
+    while (auto value = stack.Pop()) {
+        ++seen[*value];
+    }
+    CHECK(stack.Empty());
+    int wrong = 0;
+    for (int count : seen) {
+        wrong += count != 1;
+    }
+    CHECK(wrong == 0);
+}
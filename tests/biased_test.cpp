@@ -0,0 +1,106 @@
+#include "harness.h"
+
+#include "biased.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Tracked {
+    static inline std::atomic<int> live{0};
+    int value;
+
+    explicit Tracked(int v) : value(v) {
+        live.fetch_add(1);
+    }
+    ~Tracked() {
+        live.fetch_sub(1);
+    }
+};
+
+using Ptr = SharedPtr<Tracked, BiasedPolicy>;
+
+}  // namespace
+
+TEST(OwnerThreadCountsLocally) {
+    {
+        auto ptr = MakeShared<Tracked, BiasedPolicy>(1);
+        auto copy = ptr;
+        CHECK(ptr.UseCount() == 2);
+        copy.Reset();
+        CHECK(ptr.UseCount() == 1);
+    }
+    CHECK(Tracked::live.load() == 0);
+}
+
+// Copies released on other threads while the owner is alive go through its queue
+TEST(ReleasedOnOtherThreadsWhileOwnerLives) {
+    auto ptr = MakeShared<Tracked, BiasedPolicy>(2);
+    std::vector<Ptr> copies(64, ptr);
+    std::thread other([&copies] {
+        for (Ptr& copy : copies) {
+            CHECK(copy->value == 2);
+            copy.Reset();
+        }
+    });
+    other.join();
+    DrainBiasedQueue();
+    CHECK(Tracked::live.load() == 1);
+    ptr.Reset();
+    DrainBiasedQueue();
+    CHECK(Tracked::live.load() == 0);
+}
+
+// The owner exits first, the last releases merge on the releasing threads
+TEST(OwnerExitsBeforeTheReleases) {
+    std::vector<Ptr> copies;
+    WeakPtr<Tracked, BiasedPolicy> weak;
+    std::thread owner([&copies, &weak] {
+        auto ptr = MakeShared<Tracked, BiasedPolicy>(3);
+        weak = ptr;
+        copies.assign(8, ptr);
+    });
+    owner.join();
+    std::vector<std::thread> threads;
+    for (Ptr& copy : copies) {
+        threads.emplace_back([&copy] {
+            Ptr mine = std::move(copy);
+            CHECK(mine->value == 3);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(weak.Expired());
+    CHECK(Tracked::live.load() == 0);
+}
+
+// Owner exit racing with releases on other threads, meant for TSan
+TEST(OwnerExitRacesWithReleases) {
+    for (int round = 0; round < 50; ++round) {
+        std::vector<Ptr> copies;
+        std::atomic<bool> go{false};
+        std::vector<std::thread> threads;
+        std::thread owner([&] {
+            auto ptr = MakeShared<Tracked, BiasedPolicy>(round);
+            copies.assign(4, ptr);
+            for (Ptr& copy : copies) {
+                threads.emplace_back([&copy, &go] {
+                    while (!go.load()) {
+                    }
+                    copy.Reset();
+                });
+            }
+            go.store(true);
+        });
+        owner.join();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    CHECK(Tracked::live.load() == 0);
+}
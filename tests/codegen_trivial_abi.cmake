@@ -0,0 +1,58 @@
+# Compiles codegen_trivial_abi.cpp to assembly with clang, with and without the trivial ABI mode,
+# and checks that only the former forwards a `UniquePtr` with a tail call, like a raw pointer.
+# Run by ctest with CLANGXX, SYSTEM, PROCESSOR, SOURCE, INCLUDE_DIR and OUTPUT_DIR set; prints
+# "Skipped:" where there is no clang or the target is not x86-64 Linux.
+
+if(NOT CLANGXX)
+    message("Skipped: clang++ not found")
+    return()
+endif()
+if(NOT SYSTEM STREQUAL "Linux" OR NOT PROCESSOR MATCHES "^(x86_64|AMD64|amd64)$")
+    message("Skipped: the check reads x86-64 Linux assembly")
+    return()
+endif()
+
+function(compile_to_assembly output)
+    execute_process(
+        COMMAND ${CLANGXX} -std=c++20 -O2 -S -I${INCLUDE_DIR} ${ARGN} ${SOURCE} -o ${output}
+        RESULT_VARIABLE result ERROR_VARIABLE errors)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${CLANGXX} failed:\n${errors}")
+    endif()
+    file(READ ${output} assembly)
+    set(assembly "${assembly}" PARENT_SCOPE)
+endfunction()
+
+# Instructions of the function `name` in `assembly`
+function(function_body name out)
+    string(FIND "${assembly}" "\n${name}:" begin)
+    if(begin EQUAL -1)
+        message(FATAL_ERROR "No function ${name} in the assembly")
+    endif()
+    string(SUBSTRING "${assembly}" ${begin} -1 body)
+    string(FIND "${body}" ".cfi_endproc" end)
+    string(SUBSTRING "${body}" 0 ${end} body)
+    set(${out} "${body}" PARENT_SCOPE)
+endfunction()
+
+function(expect_tail_call name callee expected)
+    function_body(${name} body)
+    if(body MATCHES "\n[ \t]*jmp[ \t]+${callee}[@\n]" AND NOT body MATCHES "\n[ \t]*call")
+        set(tail_call TRUE)
+    else()
+        set(tail_call FALSE)
+    endif()
+    if(NOT tail_call STREQUAL expected)
+        message(FATAL_ERROR "${name}: expected tail call ${expected}, got:\n${body}")
+    endif()
+endfunction()
+
+compile_to_assembly(${OUTPUT_DIR}/codegen_trivial_abi.s -DSMART_PTRS_TRIVIAL_ABI)
+expect_tail_call(ForwardRaw SinkRaw TRUE)
+expect_tail_call(Forward Sink TRUE)
+
+# Shows the check tells the two conventions apart
+compile_to_assembly(${OUTPUT_DIR}/codegen_default_abi.s)
+expect_tail_call(Forward Sink FALSE)
+
+message("Forward passes UniquePtr<int> in a register")
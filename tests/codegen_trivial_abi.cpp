@@ -0,0 +1,16 @@
+// Compiled to assembly by codegen_trivial_abi.cmake, never linked
+#include "unique.h"
+
+#include <utility>
+
+extern "C" void Sink(UniquePtr<int> ptr);
+extern "C" void SinkRaw(int* ptr);
+
+// In the trivial ABI mode the pointer stays in its register and the call becomes a jump, as for
+// the raw pointer. Otherwise the argument is passed by address and destroyed after the call.
+extern "C" void Forward(UniquePtr<int> ptr) {
+    Sink(std::move(ptr));
+}
+extern "C" void ForwardRaw(int* ptr) {
+    SinkRaw(ptr);
+}
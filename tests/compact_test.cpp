@@ -0,0 +1,139 @@
+#include "harness.h"
+
+#include "arena.h"
+#include "compact.h"
+#include "weak.h"
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Tracked {
+    static inline int live = 0;
+    int value;
+
+    explicit Tracked(int v = 0) : value(v) {
+        ++live;
+    }
+    ~Tracked() {
+        --live;
+    }
+};
+
+struct Pair {
+    int first = 1;
+    int second = 2;
+};
+
+struct Base {
+    virtual ~Base() = default;
+};
+struct Derived : Base {
+    int value = 3;
+};
+
+struct Large {
+    char bytes[kMakeSharedInlineLimit + 1] = {};
+};
+
+template <typename T>
+bool ConversionThrows(const SharedPtr<T>& ptr) {
+    try {
+        CompactSharedPtr<T> compact(ptr);
+    } catch (const BadCompactPtr&) {
+        return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+TEST(OnePointerWide) {
+    static_assert(sizeof(CompactSharedPtr<Tracked>) == sizeof(void*));
+    {
+        auto ptr = MakeCompactShared<Tracked>(4);
+        CHECK(ptr->value == 4);
+        CHECK((*ptr).value == 4);
+        CHECK(ptr.UseCount() == 1);
+        auto copy = ptr;
+        CHECK(copy == ptr);
+        CHECK(ptr.UseCount() == 2);
+        auto moved = std::move(copy);
+        CHECK(!copy);
+        CHECK(ptr.UseCount() == 2);
+        moved.Reset();
+        CHECK(ptr.UseCount() == 1);
+    }
+    CHECK(Tracked::live == 0);
+}
+
+TEST(RoundTripThroughSharedPtr) {
+    auto shared = MakeShared<Tracked>(5);
+    CompactSharedPtr<Tracked> compact(shared);
+    CHECK(compact.Get() == shared.Get());
+    CHECK(shared.UseCount() == 2);
+    SharedPtr<Tracked> back = compact;
+    CHECK(back == shared);
+    CHECK(shared.UseCount() == 3);
+    SharedPtr<Tracked> moved_back = std::move(compact);
+    CHECK(!compact);
+    CHECK(shared.UseCount() == 3);
+    CompactSharedPtr<Tracked> from_rvalue(std::move(moved_back));
+    CHECK(!moved_back);
+    CHECK(from_rvalue.Get() == shared.Get());
+    WeakPtr<Tracked> weak{SharedPtr<Tracked>(from_rvalue)};
+    shared.Reset();
+    back.Reset();
+    CHECK(!weak.Expired());
+    from_rvalue.Reset();
+    CHECK(weak.Expired());
+    CHECK(Tracked::live == 0);
+
+    CompactSharedPtr<Tracked> empty{SharedPtr<Tracked>()};
+    CHECK(!empty);
+    CHECK(!SharedPtr<Tracked>(empty));
+}
+
+// Pointers to an object without a block must not convert to an empty pointer
+TEST(PointersWithoutABlockThrow) {
+    Tracked local;
+    CHECK(ConversionThrows(SharedPtr<Tracked>(SharedPtr<Pair>(), &local)));
+    MonotonicArena arena;
+    CHECK(ConversionThrows(MakeSharedUncounted<Pair>(arena)));
+    // The same through the moving constructor
+    bool thrown = false;
+    try {
+        CompactSharedPtr<Tracked> compact(SharedPtr<Tracked>(SharedPtr<Pair>(), &local));
+    } catch (const BadCompactPtr&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+TEST(OnlyInlineObjectsConvert) {
+    CHECK(ConversionThrows(SharedPtr<Tracked>(new Tracked)));
+    auto pair = MakeShared<Pair>();
+    CHECK(ConversionThrows(SharedPtr<int>(pair, &pair->second)));
+    CHECK(ConversionThrows(MakeShared<Large>()));
+    CHECK(ConversionThrows(SharedPtr<Base>(MakeShared<Derived>())));
+    CHECK(MakeCompactShared<Large>().UseCount() == 1);
+    CHECK(Tracked::live == 0);
+}
+
+TEST(AtomicPolicyAcrossThreads) {
+    auto ptr = MakeCompactShared<int, AtomicPolicy>(7);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([ptr] {
+            std::vector<CompactSharedPtr<int, AtomicPolicy>> copies(1000, ptr);
+            for (const auto& copy : copies) {
+                CHECK(*copy == 7);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(ptr.UseCount() == 1);
+}
@@ -0,0 +1,118 @@
+#include "harness.h"
+
+#include "cow.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Counts its copies, throws from the copy constructor while `fail_copies` is set
+struct Config {
+    static inline int copies = 0;
+    static inline bool fail_copies = false;
+    int threads = 1;
+    std::string name = "default";
+
+    Config() = default;
+    Config(int t, std::string n) : threads(t), name(std::move(n)) {
+    }
+    Config(const Config& other) : threads(other.threads), name(other.name) {
+        if (fail_copies) {
+            throw 1;
+        }
+        ++copies;
+    }
+};
+
+}  // namespace
+
+TEST(CopiesShareUntilWritten) {
+    Config::copies = 0;
+    auto config = MakeCow<Config>(4, "base");
+    CowPtr<Config> copy = config;
+    CHECK(copy == config);
+    CHECK(config.UseCount() == 2);
+    CHECK(!copy.Unique());
+    CHECK(copy->threads == 4);
+    CHECK(Config::copies == 0);
+
+    copy.Write().threads = 8;
+    CHECK(Config::copies == 1);
+    CHECK(!(copy == config));
+    CHECK(config->threads == 4);
+    CHECK(copy->threads == 8);
+    CHECK(copy.Unique());
+    CHECK(config.Unique());
+
+    // Already unique, written in place
+    copy.Write().name = "copy";
+    CHECK(Config::copies == 1);
+    CHECK(config.Read().name == "base");
+}
+
+TEST(MutateClonesOnce) {
+    CowPtr<Config> config(Config(2, "x"));
+    CowPtr<Config> copy = config;
+    Config::copies = 0;
+    int result = copy.Mutate([](Config& c) {
+        c.threads = 16;
+        c.name = "y";
+        return c.threads;
+    });
+    CHECK(result == 16);
+    CHECK(Config::copies == 1);
+    CHECK((*config).name == "x");
+    CHECK((*copy).name == "y");
+}
+
+TEST(FailedCloneLeavesTheValue) {
+    auto config = MakeCow<Config>(3, "kept");
+    CowPtr<Config> copy = config;
+    Config::fail_copies = true;
+    bool thrown = false;
+    try {
+        copy.Write();
+    } catch (int) {
+        thrown = true;
+    }
+    Config::fail_copies = false;
+    CHECK(thrown);
+    CHECK(copy == config);
+    CHECK(copy->name == "kept");
+}
+
+TEST(EmptyAndAssignment) {
+    CowPtr<Config> empty;
+    CHECK(!empty);
+    CHECK(empty.UseCount() == 0);
+    auto config = MakeCow<Config>();
+    empty = config;
+    CHECK(empty == config);
+    CowPtr<Config> moved = std::move(empty);
+    CHECK(!empty);
+    CHECK(moved == config);
+    moved.Reset();
+    CHECK(config.Unique());
+}
+
+TEST(AtomicPolicyAcrossThreads) {
+    auto shared = MakeCow<std::vector<int>, AtomicPolicy>(100, 1);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([shared, t]() mutable {
+            for (int round = 0; round < 200; ++round) {
+                CowPtr<std::vector<int>, AtomicPolicy> mine = shared;
+                mine.Write()[0] = t;
+                CHECK((*mine)[0] == t);
+                CHECK((*shared)[0] == 1);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK((*shared)[0] == 1);
+    CHECK(shared.Unique());
+}
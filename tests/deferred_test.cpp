@@ -0,0 +1,115 @@
+#include "harness.h"
+
+#include "deferred.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Policy = DeferredPolicy<>;
+
+struct Tracked {
+    static inline std::atomic<int> live{0};
+    int value;
+
+    explicit Tracked(int v = 0) : value(v) {
+        live.fetch_add(1);
+    }
+    ~Tracked() {
+        live.fetch_sub(1);
+    }
+};
+
+struct Link {
+    static inline std::atomic<int> live{0};
+    SharedPtr<Link, Policy> next;
+
+    Link() {
+        live.fetch_add(1);
+    }
+    ~Link() {
+        live.fetch_sub(1);
+    }
+};
+
+}  // namespace
+
+TEST(LastReleaseIsDeferred) {
+    WeakPtr<Tracked, Policy> weak;
+    {
+        auto ptr = MakeShared<Tracked, Policy>(1);
+        weak = ptr;
+        auto copy = ptr;
+    }
+    CHECK(Tracked::live.load() == 1);
+    // Queued objects count as expired
+    CHECK(weak.Expired());
+    CHECK(!weak.Lock());
+    CHECK(!DeferredQueue::Empty());
+    CHECK(DrainDeferred() == 1);
+    CHECK(Tracked::live.load() == 0);
+    CHECK(DeferredQueue::Empty());
+}
+
+TEST(DrainRespectsTheBudget) {
+    for (int i = 0; i < 10; ++i) {
+        MakeShared<Tracked, Policy>(i);
+        SharedPtr<Tracked, Policy>(new Tracked(i));
+    }
+    CHECK(Tracked::live.load() == 20);
+    CHECK(DrainDeferred(5) == 5);
+    CHECK(Tracked::live.load() == 15);
+    CHECK(DrainDeferred() == 15);
+    CHECK(Tracked::live.load() == 0);
+}
+
+// A chain far longer than the stack could take recursively is torn down link by link
+TEST(LongChainWithConstantStackDepth) {
+    constexpr int kLength = 200000;
+    {
+        auto head = MakeShared<Link, Policy>();
+        Link* tail = head.Get();
+        for (int i = 1; i < kLength; ++i) {
+            tail->next = MakeShared<Link, Policy>();
+            tail = tail->next.Get();
+        }
+    }
+    CHECK(Link::live.load() == kLength);
+    CHECK(DrainDeferred() == kLength);
+    CHECK(Link::live.load() == 0);
+}
+
+TEST(SingleThreadedBase) {
+    {
+        auto ptr = MakeShared<Tracked, DeferredPolicy<SingleThreadedPolicy>>(2);
+    }
+    CHECK(Tracked::live.load() == 1);
+    CHECK(DrainDeferred() == 1);
+    CHECK(Tracked::live.load() == 0);
+}
+
+TEST(BackgroundReclaimer) {
+    {
+        DeferredReclaimer reclaimer(std::chrono::microseconds(100), 64);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([] {
+                for (int i = 0; i < 5000; ++i) {
+                    auto ptr = MakeShared<Tracked, Policy>(i);
+                    WeakPtr<Tracked, Policy> weak(ptr);
+                    auto copy = weak.Lock();
+                    CHECK(copy->value == i);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    CHECK(Tracked::live.load() == 0);
+    CHECK(DeferredQueue::Empty());
+}
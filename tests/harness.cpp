@@ -0,0 +1,62 @@
+#include "harness.h"
+
+#include <cstdio>
+#include <exception>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Runner and entry point of every test binary.
+//
+// Usage: <test binary> [SUBSTR]
+
+namespace {
+
+struct Test {
+    std::string name;
+    TestFunction function;
+};
+
+std::vector<Test>& Registry() {
+    static std::vector<Test> tests;
+    return tests;
+}
+
+int failures = 0;
+
+}  // namespace
+
+int RegisterTest(std::string name, TestFunction function) {
+    Registry().push_back({std::move(name), std::move(function)});
+    return 0;
+}
+
+void ReportFailure(const char* expression, const char* file, int line) {
+    std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expression);
+    ++failures;
+}
+
+int main(int argc, char** argv) {
+    std::string_view filter = argc > 1 ? argv[1] : "";
+    int failed = 0;
+    int run = 0;
+    for (const Test& test : Registry()) {
+        if (test.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        int before = failures;
+        try {
+            test.function();
+        } catch (const TestAbort&) {
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "unexpected exception: %s\n", e.what());
+            ++failures;
+        }
+        ++run;
+        bool passed = failures == before;
+        failed += passed ? 0 : 1;
+        std::printf("[%s] %s\n", passed ? "  OK  " : " FAIL ", test.name.c_str());
+    }
+    std::printf("%d tests, %d failed\n", run, failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+// Minimal self-contained test harness, in the spirit of the benchmark one:
+//
+//     TEST(CopyIncrementsUseCount) {
+//         auto ptr = MakeShared<int>(0);
+//         auto copy = ptr;
+//         CHECK(ptr.UseCount() == 2);
+//     }
+//
+// A failed `CHECK` reports the expression and its location and fails the test, which goes on
+// running. `REQUIRE` stops the test instead. Every test file is a binary of its own, registered
+// with ctest; `./test_binary SUBSTR` runs only the tests whose name contains `SUBSTR`.
+
+using TestFunction = std::function<void()>;
+
+int RegisterTest(std::string name, TestFunction function);
+
+// Records a failure of the running test
+void ReportFailure(const char* expression, const char* file, int line);
+
+struct TestAbort {};
+
+#define TEST(name)                                                                   \
+    static void Test##name();                                                        \
+    [[maybe_unused]] static const int kTest##name = RegisterTest(#name, Test##name); \
+    static void Test##name()
+
+#define CHECK(condition)                                   \
+    do {                                                   \
+        if (!(condition)) {                                \
+            ReportFailure(#condition, __FILE__, __LINE__); \
+        }                                                  \
+    } while (false)
+
+#define REQUIRE(condition)                                 \
+    do {                                                   \
+        if (!(condition)) {                                \
+            ReportFailure(#condition, __FILE__, __LINE__); \
+            throw TestAbort();                             \
+        }                                                  \
+    } while (false)
@@ -0,0 +1,217 @@
+#include "harness.h"
+
+#include "inline_box.h"
+
+#include <cstdint>
+#include <string>
+
+namespace {
+
+// No virtual destructor: the box destroys objects as their own type
+struct Shape {
+    virtual int Area() const = 0;
+};
+
+struct Square : Shape {
+    static inline int live = 0;
+    int side;
+
+    explicit Square(int s) : side(s) {
+        ++live;
+    }
+    Square(Square&& other) noexcept : side(other.side) {
+        ++live;
+    }
+    ~Square() {
+        --live;
+    }
+    int Area() const override {
+        return side * side;
+    }
+};
+
+struct Big : Shape {
+    static inline int live = 0;
+    char payload[256] = {};
+    int area;
+
+    explicit Big(int a) : area(a) {
+        ++live;
+    }
+    ~Big() {
+        --live;
+    }
+    int Area() const override {
+        return area;
+    }
+};
+
+// Heap objects go back through the class's own deallocation
+struct Pooled : Shape {
+    static inline int allocated = 0;
+
+    static void* operator new(size_t size) {
+        ++allocated;
+        return ::operator new(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        --allocated;
+        ::operator delete(ptr, size);
+    }
+    char payload[128] = {};
+    int Area() const override {
+        return 1;
+    }
+};
+
+struct alignas(128) Aligned : Shape {
+    int Area() const override {
+        return 2;
+    }
+};
+
+// Small, but its move may throw, so it goes to the heap
+struct Throwing : Shape {
+    std::string name = "throwing";
+
+    Throwing() = default;
+    Throwing(Throwing&&) noexcept(false) = default;
+    int Area() const override {
+        return 0;
+    }
+};
+
+struct Animal {
+    virtual ~Animal() = default;
+    virtual std::string Sound() const = 0;
+};
+
+struct Cat : Animal {
+    static inline int live = 0;
+
+    Cat() {
+        ++live;
+    }
+    Cat(Cat&&) noexcept {
+        ++live;
+    }
+    ~Cat() override {
+        --live;
+    }
+    std::string Sound() const override {
+        return "meow";
+    }
+};
+
+}  // namespace
+
+TEST(InlineAndHeapStorage) {
+    {
+        auto square = MakeInlineBox<Shape, Square>(3);
+        CHECK(square.IsInline());
+        CHECK(square->Area() == 9);
+        CHECK(reinterpret_cast<const char*>(square.Get()) >= reinterpret_cast<const char*>(&square));
+        CHECK(reinterpret_cast<const char*>(square.Get()) <
+              reinterpret_cast<const char*>(&square) + sizeof(square));
+
+        auto big = MakeInlineBox<Shape, Big>(7);
+        CHECK(big);
+        CHECK(!big.IsInline());
+        CHECK(big->Area() == 7);
+
+        auto throwing = MakeInlineBox<Shape, Throwing>();
+        CHECK(!throwing.IsInline());
+        CHECK(Square::live == 1);
+        CHECK(Big::live == 1);
+    }
+    CHECK(Square::live == 0);
+    CHECK(Big::live == 0);
+}
+
+TEST(HeapDeallocation) {
+    {
+        auto pooled = MakeInlineBox<Shape, Pooled>();
+        CHECK(!pooled.IsInline());
+        CHECK(Pooled::allocated == 1);
+        pooled.Emplace<Aligned>();
+        CHECK(Pooled::allocated == 0);
+        CHECK(!pooled.IsInline());
+        CHECK(reinterpret_cast<uintptr_t>(pooled.Get()) % 128 == 0);
+        CHECK(pooled->Area() == 2);
+    }
+    CHECK(Pooled::allocated == 0);
+}
+
+TEST(Moves) {
+    {
+        auto first = MakeInlineBox<Shape, Square>(2);
+        InlineBox<Shape> second(std::move(first));
+        CHECK(!first);
+        CHECK(second.IsInline());
+        CHECK(second->Area() == 4);
+        CHECK(Square::live == 1);
+
+        auto big = MakeInlineBox<Shape, Big>(5);
+        Shape* heap = big.Get();
+        first = std::move(big);
+        CHECK(!big);
+        CHECK(first.Get() == heap);
+
+        first.Swap(second);
+        CHECK(first->Area() == 4);
+        CHECK(second->Area() == 5);
+        CHECK(first.IsInline());
+        CHECK(!second.IsInline());
+
+        second = nullptr;
+        CHECK(Big::live == 0);
+        first = std::move(first);
+        CHECK(first->Area() == 4);
+    }
+    CHECK(Square::live == 0);
+}
+
+TEST(Emplace) {
+    InlineBox<Shape> box;
+    CHECK(!box);
+    Square& square = box.Emplace<Square>(4);
+    CHECK(&square == box.Get());
+    CHECK(box->Area() == 16);
+    box.Emplace<Big>(1);
+    CHECK(Square::live == 0);
+    CHECK(Big::live == 1);
+    box.Reset();
+    CHECK(Big::live == 0);
+    CHECK(!box);
+}
+
+TEST(AdoptAndRelease) {
+    {
+        InlineBox<Animal> adopted(UniquePtr<Cat>(new Cat));
+        CHECK(!adopted.IsInline());
+        CHECK(adopted->Sound() == "meow");
+
+        auto inline_cat = MakeInlineBox<Animal, Cat>();
+        CHECK(inline_cat.IsInline());
+        Animal* released = inline_cat.Release();
+        CHECK(!inline_cat);
+        CHECK(Cat::live == 2);
+        CHECK(released->Sound() == "meow");
+        delete released;
+        CHECK(Cat::live == 1);
+
+        InlineBox<Animal> empty(UniquePtr<Cat>{});
+        CHECK(!empty);
+        CHECK(empty.Release() == nullptr);
+    }
+    CHECK(Cat::live == 0);
+}
+
+TEST(CustomSize) {
+    using Tiny = InlineBox<Shape, sizeof(Square), alignof(Square)>;
+    static_assert(Tiny::kInlineSize == sizeof(Square));
+    auto square = MakeInlineBox<Shape, Square, sizeof(Square), alignof(Square)>(1);
+    CHECK(square.IsInline());
+    Tiny big(std::in_place_type<Big>, 2);
+    CHECK(!big.IsInline());
+}
@@ -0,0 +1,75 @@
+// Built with SMART_PTRS_INSTRUMENTATION, see CMakeLists.txt
+#include "harness.h"
+
+#include "shared.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <sstream>
+
+namespace {
+
+struct Widget {
+    int value = 0;
+};
+struct Gadget {
+    int value = 0;
+};
+
+TypeStatsSnapshot StatsOf(const std::string& type) {
+    for (const TypeStatsSnapshot& stats : SnapshotStats()) {
+        if (stats.type == type) {
+            return stats;
+        }
+    }
+    return {};
+}
+
+}  // namespace
+
+TEST(CountsSharedAndWeakTraffic) {
+    static_assert(kInstrumentation);
+    const std::string type = "(anonymous namespace)::Widget";
+    {
+        auto ptr = MakeShared<Widget>();
+        TypeStatsSnapshot created = StatsOf(type);
+        CHECK(created.allocations == 1);
+        CHECK(created.live == 1);
+        CHECK(created.peak_live == 1);
+
+        auto copy = ptr;
+        auto other = MakeShared<Widget>();
+        CHECK(StatsOf(type).strong_increments == created.strong_increments + 1);
+        CHECK(StatsOf(type).peak_live == 2);
+
+        WeakPtr<Widget> weak(ptr);
+        CHECK(StatsOf(type).weak_increments == created.weak_increments + 1);
+        ptr.Reset();
+        copy.Reset();
+        other.Reset();
+        TypeStatsSnapshot weak_only = StatsOf(type);
+        CHECK(weak_only.live == 0);
+        CHECK(weak_only.weak_only == 1);
+    }
+    TypeStatsSnapshot done = StatsOf(type);
+    CHECK(done.allocations == 2);
+    CHECK(done.live == 0);
+    CHECK(done.weak_only == 0);
+}
+
+TEST(CountsUniqueDeletes) {
+    const std::string type = "(anonymous namespace)::Gadget";
+    {
+        UniquePtr<Gadget> first(new Gadget);
+        UniquePtr<Gadget> second(new Gadget);
+        second.Reset();
+    }
+    CHECK(StatsOf(type).unique_deletes == 2);
+}
+
+TEST(DumpStats) {
+    MakeShared<Widget>();
+    std::ostringstream out;
+    DumpStats(out);
+    CHECK(out.str().find("Widget: allocations=") != std::string::npos);
+}
@@ -0,0 +1,100 @@
+#include "harness.h"
+
+#include "intrusive.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+template <typename Policy>
+struct Node : RefCounted<Node<Policy>, Policy> {
+    static inline std::atomic<int> live{0};
+    IntrusivePtr<Node> next;
+
+    Node() {
+        live.fetch_add(1);
+    }
+    ~Node() {
+        live.fetch_sub(1);
+    }
+};
+
+// Takes weak handles to itself while it is being built and torn down
+struct SelfObserver : RefCounted<SelfObserver> {
+    static inline bool locked_in_destructor = true;
+    IntrusiveWeakPtr<SelfObserver> self;
+
+    SelfObserver() : self(WeakFromThis()) {
+    }
+    ~SelfObserver() {
+        IntrusiveWeakPtr<SelfObserver> last = WeakFromThis();
+        locked_in_destructor = static_cast<bool>(last.Lock());
+    }
+};
+
+}  // namespace
+
+TEST(CopyAndRelease) {
+    using N = Node<SingleThreadedPolicy>;
+    {
+        auto node = MakeIntrusive<N>();
+        CHECK(node.UseCount() == 1);
+        auto copy = node;
+        CHECK(node.UseCount() == 2);
+        IntrusivePtr<N> again(node.Get());
+        CHECK(node.UseCount() == 3);
+        node->next = MakeIntrusive<N>();
+        CHECK(N::live.load() == 2);
+    }
+    CHECK(N::live.load() == 0);
+}
+
+TEST(WeakExpiresWithTheObject) {
+    using N = Node<SingleThreadedPolicy>;
+    IntrusiveWeakPtr<N> weak;
+    {
+        auto node = MakeIntrusive<N>();
+        weak = node;
+        CHECK(weak.Lock() == node);
+        CHECK(node->WeakFromThis().Lock() == node);
+    }
+    CHECK(weak.Expired());
+    CHECK(!weak.Lock());
+    CHECK(N::live.load() == 0);
+}
+
+TEST(WeakFromThisInConstructorAndDestructor) {
+    IntrusiveWeakPtr<SelfObserver> weak;
+    {
+        auto object = MakeIntrusive<SelfObserver>();
+        weak = object->self;
+        CHECK(object->self.Lock() == object);
+        CHECK(object.UseCount() == 1);
+    }
+    CHECK(weak.Expired());
+    CHECK(!SelfObserver::locked_in_destructor);
+}
+
+TEST(AtomicPolicyAcrossThreads) {
+    using N = Node<AtomicPolicy>;
+    {
+        auto node = MakeIntrusive<N>();
+        IntrusiveWeakPtr<N> weak = node;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([node, weak] {
+                for (int round = 0; round < 1000; ++round) {
+                    auto copy = node;
+                    CHECK(weak.Lock() == copy);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(node.UseCount() == 1);
+    }
+    CHECK(N::live.load() == 0);
+}
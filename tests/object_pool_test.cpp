@@ -0,0 +1,122 @@
+#include "harness.h"
+
+#include "object_pool.h"
+
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Message {
+    static inline std::atomic<int> live{0};
+    int id;
+
+    explicit Message(int i = 0) : id(i) {
+        if (i < 0) {
+            throw i;
+        }
+        live.fetch_add(1);
+    }
+    ~Message() {
+        live.fetch_sub(1);
+    }
+};
+
+// One type per test, so the global pools do not share counters
+template <int Tag>
+struct Tagged : Message {
+    using Message::Message;
+};
+
+}  // namespace
+
+TEST(EmptyDeletersTakeNoSpace) {
+    static_assert(sizeof(UniquePtr<Message, PoolDeleter<Message>>) == sizeof(void*));
+    static_assert(sizeof(UniquePtr<Message, PoolDeleter<Message, ThreadLocalPool>>) ==
+                  sizeof(void*));
+}
+
+TEST(OwnPoolRecyclesMemory) {
+    ObjectPool<Message> pool;
+    Message* first = nullptr;
+    {
+        auto message = pool.Acquire(1);
+        first = message.Get();
+        CHECK(message->id == 1);
+        CHECK(pool.Stats().live == 1);
+    }
+    CHECK(Message::live.load() == 0);
+    auto again = pool.Acquire(2);
+    CHECK(again.Get() == first);
+    CHECK(again->id == 2);
+    ObjectPoolStats stats = pool.Stats();
+    CHECK(stats.acquires == 2);
+    CHECK(stats.hits == 1);
+    CHECK(stats.high_water == 1);
+    CHECK(stats.HitRate() == 0.5);
+}
+
+TEST(ThrowingConstructorKeepsTheSlot) {
+    ObjectPool<Message> pool;
+    bool thrown = false;
+    try {
+        pool.Acquire(-1);
+    } catch (int) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(pool.Stats().live == 0);
+    auto message = pool.Acquire(3);
+    CHECK(pool.Stats().hits == 1);
+}
+
+TEST(GlobalPool) {
+    using T = Tagged<1>;
+    T* first = AcquirePooled<T>(1).Get();
+    auto message = AcquirePooled<T>(2);
+    CHECK(message.Get() == first);
+    CHECK(ObjectPool<T>::Global().Stats().hits == 1);
+}
+
+// Released on other threads, the slots come back through the thread-local and global pools
+TEST(ThreadLocalPoolsAcrossThreads) {
+    using T = Tagged<2>;
+    std::vector<UniquePtr<T, PoolDeleter<T, ThreadLocalPool>>> messages;
+    for (int i = 0; i < 100; ++i) {
+        messages.push_back(AcquirePooled<T, ThreadLocalPool>(i));
+    }
+    std::thread([moved = std::move(messages)]() mutable { moved.clear(); }).join();
+    // The exited thread handed its slots to the global pool
+    CHECK(ObjectPool<T>::Global().Stats().live == 0);
+    auto from_global = ObjectPool<T>::Global().Acquire(1);
+    CHECK(ObjectPool<T>::Global().Stats().hits == 1);
+    CHECK(Message::live.load() == 1);
+}
+
+TEST(ConcurrentAcquireAndRelease) {
+    using T = Tagged<3>;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([t] {
+            std::vector<UniquePtr<T, PoolDeleter<T>>> held;
+            for (int round = 0; round < 2000; ++round) {
+                held.push_back(AcquirePooled<T>(t));
+                if (held.size() == 8) {
+                    std::set<T*> distinct;
+                    for (const auto& message : held) {
+                        CHECK(message->id == t);
+                        distinct.insert(message.Get());
+                    }
+                    CHECK(distinct.size() == held.size());
+                    held.clear();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(ObjectPool<T>::Global().Stats().live == 0);
+    CHECK(ObjectPool<T>::Global().Stats().high_water <= 32);
+}
@@ -0,0 +1,219 @@
+#include "harness.h"
+
+#include "offset_shared.h"
+
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+struct Dataset {
+    size_t size;
+    double values[1000];
+    OffsetPtr<double> first;
+};
+
+struct Node {
+    int value = 0;
+    OffsetSharedPtr<Node> next = {};
+};
+
+// Exit code of a forked child, -1 if it did not exit normally
+int Wait(pid_t pid) {
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+}  // namespace
+
+// A child process attaches to the root, releases it and exits; the segment ends up empty again
+TEST(ForkedChildReleasesTheRoot) {
+    ShmSegment segment = ShmSegment::CreateAnonymous(1 << 20);
+    const size_t initial = segment.FreeBytes();
+    {
+        auto data = MakeOffsetShared<Dataset>(segment);
+        data->size = 1000;
+        for (size_t i = 0; i < data->size; ++i) {
+            data->values[i] = i * 0.5;
+        }
+        data->first = &data->values[0];
+        segment.PublishRoot(data);
+        CHECK(data.UseCount() == 2);
+        CHECK(segment.FreeBytes() < initial);
+
+        pid_t pid = fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            int code = 0;
+            {
+                auto mine = segment.Root<Dataset>();
+                double sum = 0;
+                for (size_t i = 0; i < mine->size; ++i) {
+                    sum += mine->values[i];
+                }
+                if (sum != 0.5 * (1000.0 * 999 / 2) || *mine->first != 0.0) {
+                    code = 1;
+                } else if (mine.UseCount() != 3) {
+                    code = 2;
+                }
+                // Shared memory, so the parent sees the write
+                mine->values[0] = 42;
+            }
+            _exit(code);
+        }
+        CHECK(Wait(pid) == 0);
+        CHECK(data->values[0] == 42);
+        CHECK(data.UseCount() == 2);
+        segment.PublishRoot(OffsetSharedPtr<Dataset>());
+    }
+    CHECK(segment.FreeBytes() == initial);
+}
+
+// The child holds the last reference and frees the object from its own process
+TEST(ForkedChildDetachesLast) {
+    ShmSegment segment = ShmSegment::CreateAnonymous(1 << 20);
+    const size_t initial = segment.FreeBytes();
+    OffsetWeakPtr<Node> weak;
+    {
+        auto node = MakeOffsetShared<Node>(segment, 1);
+        node->next = MakeOffsetShared<Node>(segment, 2);
+        segment.PublishRoot(node);
+        weak = node;
+    }
+    CHECK(!weak.Expired());
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+        {
+            auto root = segment.Root<Node>();
+            segment.PublishRoot(OffsetSharedPtr<Node>());
+            if (root->next->value != 2) {
+                _exit(1);
+            }
+        }
+        _exit(0);
+    }
+    CHECK(Wait(pid) == 0);
+    CHECK(weak.Expired());
+    CHECK(!weak.Lock());
+    bool thrown = false;
+    try {
+        OffsetSharedPtr<Node> promoted(weak);
+    } catch (const BadWeakPtr&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    weak.Reset();
+    CHECK(segment.FreeBytes() == initial);
+}
+
+// Children copy the root and allocate concurrently
+TEST(ConcurrentChildren) {
+    ShmSegment segment = ShmSegment::CreateAnonymous(1 << 20);
+    const size_t initial = segment.FreeBytes();
+    segment.PublishRoot(MakeOffsetShared<Node>(segment, 5));
+    std::vector<pid_t> children;
+    for (int child = 0; child < 4; ++child) {
+        pid_t pid = fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            {
+                auto root = segment.Root<Node>();
+                for (int i = 0; i < 20000; ++i) {
+                    auto copy = root;
+                    OffsetWeakPtr<Node> weak(copy);
+                    if (!weak.Lock()) {
+                        _exit(1);
+                    }
+                }
+                for (int i = 0; i < 200; ++i) {
+                    MakeOffsetShared<Node>(segment, i);
+                }
+            }
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    for (pid_t pid : children) {
+        CHECK(Wait(pid) == 0);
+    }
+    CHECK(segment.Root<Node>().UseCount() == 2);
+    segment.PublishRoot(OffsetSharedPtr<Node>());
+    CHECK(segment.FreeBytes() == initial);
+}
+
+// Offsets stay valid when the segment is mapped at another address
+TEST(RemappedSegment) {
+    ShmSegment segment = ShmSegment::CreateAnonymous(1 << 20);
+    const size_t initial = segment.FreeBytes();
+    {
+        auto head = MakeOffsetShared<Node>(segment, 1);
+        head->next = MakeOffsetShared<Node>(segment, 2);
+        head->next->next = MakeOffsetShared<Node>(segment, 3);
+        segment.PublishRoot(head);
+    }
+    {
+        ShmSegment again = ShmSegment::Adopt(dup(segment.Fd()));
+        auto head = again.Root<Node>();
+        CHECK(static_cast<void*>(head.Get()) != static_cast<void*>(segment.Root<Node>().Get()));
+        int sum = 0;
+        for (Node* node = head.Get(); node != nullptr; node = node->next.Get()) {
+            sum += node->value;
+        }
+        CHECK(sum == 6);
+        again.PublishRoot(OffsetSharedPtr<Node>());
+        CHECK(head.UseCount() == 1);
+    }
+    CHECK(segment.FreeBytes() == initial);
+}
+
+TEST(AllocatorCoalesces) {
+    ShmSegment segment = ShmSegment::CreateAnonymous(1 << 20);
+    const size_t initial = segment.FreeBytes();
+    std::vector<OffsetSharedPtr<Node>> nodes;
+    for (int i = 0; i < 1000; ++i) {
+        nodes.push_back(MakeOffsetShared<Node>(segment, i));
+    }
+    for (size_t i = 0; i < nodes.size(); i += 2) {
+        nodes[i].Reset();
+    }
+    for (size_t i = 1; i < nodes.size(); i += 2) {
+        nodes[i].Reset();
+    }
+    CHECK(segment.FreeBytes() == initial);
+    struct Big {
+        char bytes[2 << 20];
+    };
+    bool full = false;
+    try {
+        MakeOffsetShared<Big>(segment);
+    } catch (const std::bad_alloc&) {
+        full = true;
+    }
+    CHECK(full);
+}
+
+TEST(NamedSegment) {
+    const std::string name = "/smart_ptrs_test_" + std::to_string(getpid());
+    ShmSegment::Unlink(name);
+    {
+        ShmSegment created = ShmSegment::Create(name, 1 << 16);
+        created.PublishRoot(MakeOffsetShared<Node>(created, 7));
+        ShmSegment opened = ShmSegment::Open(name);
+        CHECK(opened.Root<Node>()->value == 7);
+        opened.PublishRoot(OffsetSharedPtr<Node>());
+    }
+    ShmSegment::Unlink(name);
+    bool thrown = false;
+    try {
+        ShmSegment::Open(name);
+    } catch (const std::system_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
@@ -0,0 +1,140 @@
+#include "harness.h"
+
+#include "pool.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Counts the allocations made through it
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    static inline int allocated = 0;
+
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        ++CountingAllocator<char>::allocated;
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, size_t n) noexcept {
+        --CountingAllocator<char>::allocated;
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>&) const noexcept {
+        return true;
+    }
+};
+
+}  // namespace
+
+TEST(AllocationsAreAlignedAndReused) {
+    std::vector<void*> blocks;
+    for (size_t size = 1; size <= ControlBlockPool::kMaxBlockSize; size += 7) {
+        void* block = ControlBlockPool::Allocate(size);
+        CHECK(reinterpret_cast<uintptr_t>(block) % ControlBlockPool::kAlignment == 0);
+        blocks.push_back(block);
+    }
+    CHECK(std::set<void*>(blocks.begin(), blocks.end()).size() == blocks.size());
+    size_t size = 1;
+    for (void* block : blocks) {
+        ControlBlockPool::Deallocate(block, size);
+        size += 7;
+    }
+    // The owning thread gets its last freed block back
+    void* first = ControlBlockPool::Allocate(32);
+    ControlBlockPool::Deallocate(first, 32);
+    void* second = ControlBlockPool::Allocate(32);
+    CHECK(first == second);
+    ControlBlockPool::Deallocate(second, 32);
+}
+
+TEST(LargeBlocksBypassThePool) {
+    void* block = ControlBlockPool::Allocate(ControlBlockPool::kMaxBlockSize + 1);
+    CHECK(block != nullptr);
+    ControlBlockPool::Deallocate(block, ControlBlockPool::kMaxBlockSize + 1);
+}
+
+// Blocks freed on other threads go back to the owner's slabs
+TEST(RemoteFrees) {
+    for (int round = 0; round < 20; ++round) {
+        std::vector<void*> blocks;
+        for (int i = 0; i < 1000; ++i) {
+            blocks.push_back(ControlBlockPool::Allocate(48));
+        }
+        std::thread other([&blocks] {
+            for (void* block : blocks) {
+                ControlBlockPool::Deallocate(block, 48);
+            }
+        });
+        other.join();
+    }
+}
+
+// A thread exits with blocks still in use; they are freed from here later
+TEST(BlocksOutliveTheirThread) {
+    std::vector<SharedPtr<int, AtomicPolicy>> kept;
+    for (int i = 0; i < 4; ++i) {
+        std::thread([&kept, i] {
+            for (int n = 0; n < 500; ++n) {
+                kept.push_back(MakeShared<int, AtomicPolicy>(i * 500 + n));
+            }
+        }).join();
+    }
+    std::vector<bool> seen(2000, false);
+    for (const auto& ptr : kept) {
+        seen[*ptr] = true;
+    }
+    kept.clear();
+    for (bool value : seen) {
+        CHECK(value);
+    }
+}
+
+TEST(SharedPtrsReleasedAcrossThreads) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([] {
+            std::vector<SharedPtr<int, AtomicPolicy>> made;
+            for (int i = 0; i < 2000; ++i) {
+                made.push_back(MakeShared<int, AtomicPolicy>(i));
+                made.push_back(SharedPtr<int, AtomicPolicy>(new int(i)));
+            }
+            std::thread([moved = std::move(made)]() mutable { moved.clear(); }).join();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+TEST(AllocateShared) {
+    {
+        auto ptr = AllocateShared<int>(CountingAllocator<int>(), 5);
+        CHECK(*ptr == 5);
+        CHECK(CountingAllocator<char>::allocated == 1);
+        WeakPtr<int> weak(ptr);
+        ptr.Reset();
+        CHECK(weak.Expired());
+        // The weak reference keeps the block
+        CHECK(CountingAllocator<char>::allocated == 1);
+    }
+    CHECK(CountingAllocator<char>::allocated == 0);
+
+    auto pooled = AllocateShared<std::vector<int>>(PoolAllocator<int>(), 3, 7);
+    CHECK(pooled->size() == 3);
+    CHECK((*pooled)[2] == 7);
+}
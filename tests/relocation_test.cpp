@@ -0,0 +1,128 @@
+#include "harness.h"
+
+#include "../common/relocation.h"
+#include "compact.h"
+#include "cow.h"
+#include "intrusive.h"
+#include "shared.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <string>
+
+namespace {
+
+struct Tracked {
+    static inline int live = 0;
+    int value;
+
+    explicit Tracked(int v = 0) : value(v) {
+        ++live;
+    }
+    ~Tracked() {
+        --live;
+    }
+};
+
+struct Node : RefCounted<Node> {};
+
+// Not trivially relocatable, and its copy throws while `fail` is set
+struct Fragile {
+    static inline bool fail = false;
+    std::string value;
+
+    explicit Fragile(std::string v) : value(std::move(v)) {
+    }
+    Fragile(const Fragile& other) : value(other.value) {
+        if (fail) {
+            throw 1;
+        }
+    }
+    Fragile(Fragile&& other) noexcept(false) : Fragile(static_cast<const Fragile&>(other)) {
+    }
+};
+
+}  // namespace
+
+TEST(PointersAreTriviallyRelocatable) {
+    static_assert(kIsTriviallyRelocatable<SharedPtr<Tracked>>);
+    static_assert(kIsTriviallyRelocatable<WeakPtr<Tracked>>);
+    static_assert(kIsTriviallyRelocatable<UniquePtr<Tracked>>);
+    static_assert(kIsTriviallyRelocatable<IntrusivePtr<Node>>);
+    static_assert(kIsTriviallyRelocatable<CompactSharedPtr<Tracked>>);
+    static_assert(kIsTriviallyRelocatable<CowPtr<Tracked>>);
+    static_assert(kIsTriviallyRelocatable<int>);
+    static_assert(!kIsTriviallyRelocatable<Fragile>);
+}
+
+TEST(GrowingKeepsTheCounts) {
+    {
+        auto ptr = MakeShared<Tracked>(1);
+        RelocVector<SharedPtr<Tracked>> copies;
+        for (int i = 0; i < 10000; ++i) {
+            copies.PushBack(ptr);
+        }
+        CHECK(copies.Size() == 10000);
+        CHECK(copies.Capacity() >= 10000);
+        CHECK(ptr.UseCount() == 10001);
+        copies.ShrinkToFit();
+        CHECK(copies.Capacity() == 10000);
+        CHECK(copies.Back() == ptr);
+        copies.PopBack();
+        CHECK(ptr.UseCount() == 10000);
+
+        RelocVector<SharedPtr<Tracked>> copied = copies;
+        CHECK(ptr.UseCount() == 19999);
+        RelocVector<SharedPtr<Tracked>> moved = std::move(copies);
+        CHECK(copies.Empty());
+        CHECK(ptr.UseCount() == 19999);
+        moved.Clear();
+        copied = moved;
+        CHECK(ptr.UseCount() == 1);
+    }
+    CHECK(Tracked::live == 0);
+}
+
+TEST(UniquePtrs) {
+    {
+        RelocVector<UniquePtr<Tracked>> owners;
+        for (int i = 0; i < 100; ++i) {
+            owners.EmplaceBack(new Tracked(i));
+        }
+        owners.Reserve(1000);
+        CHECK(owners[42]->value == 42);
+        CHECK(Tracked::live == 100);
+    }
+    CHECK(Tracked::live == 0);
+}
+
+// The argument may be an element that moves during the reallocation
+TEST(EmplaceBackOwnElement) {
+    RelocVector<std::string> strings;
+    strings.PushBack(std::string(100, 'x'));
+    strings.ShrinkToFit();
+    strings.PushBack(strings[0]);
+    CHECK(strings.Size() == 2);
+    CHECK(strings[1] == std::string(100, 'x'));
+}
+
+// A throwing copy during reallocation leaves the vector as it was
+TEST(StrongGuarantee) {
+    RelocVector<Fragile> values;
+    values.EmplaceBack("a");
+    values.EmplaceBack("b");
+    values.ShrinkToFit();
+    Fragile::fail = true;
+    bool thrown = false;
+    try {
+        values.Reserve(10);
+    } catch (int) {
+        thrown = true;
+    }
+    Fragile::fail = false;
+    CHECK(thrown);
+    CHECK(values.Size() == 2);
+    CHECK(values.Capacity() == 2);
+    CHECK(values[0].value == "a");
+    CHECK(values[1].value == "b");
+}
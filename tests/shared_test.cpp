@@ -0,0 +1,379 @@
+#include "harness.h"
+
+#include "shared.h"
+#include "weak.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Counts live instances
+struct Tracked {
+    static inline int live = 0;
+    int value;
+
+    explicit Tracked(int v = 0) : value(v) {
+        ++live;
+    }
+    Tracked(const Tracked& other) : value(other.value) {
+        ++live;
+    }
+    ~Tracked() {
+        --live;
+    }
+};
+
+// Throws from the constructor once `left` reaches zero
+struct Fragile : Tracked {
+    static inline int left = 0;
+
+    Fragile() {
+        if (--left == 0) {
+            throw 1;
+        }
+    }
+};
+
+// Counts the instances allocated on their own with `new`
+template <size_t Size>
+struct Heavy {
+    static inline int allocated = 0;
+    char bytes[Size] = {};
+
+    static void* operator new(size_t size) {
+        ++allocated;
+        return ::operator new(size);
+    }
+    static void operator delete(void* ptr) noexcept {
+        --allocated;
+        ::operator delete(ptr);
+    }
+};
+
+// Output iterator whose assignment throws once `left` copies have been written
+struct ThrowingOutput {
+    std::vector<SharedPtr<Tracked>>* out;
+    int left;
+
+    ThrowingOutput& operator*() {
+        return *this;
+    }
+    ThrowingOutput& operator=(SharedPtr<Tracked>&& ptr) {
+        if (left-- == 0) {
+            throw 1;
+        }
+        out->push_back(std::move(ptr));
+        return *this;
+    }
+    ThrowingOutput& operator++() {
+        return *this;
+    }
+};
+
+struct Base {
+    virtual ~Base() = default;
+    int base = 1;
+};
+struct Derived : Base {
+    int derived = 2;
+};
+
+template <typename Policy>
+void CheckCopyAndRelease() {
+    {
+        auto ptr = MakeShared<Tracked, Policy>(5);
+        CHECK(ptr.UseCount() == 1);
+        {
+            auto copy = ptr;
+            CHECK(ptr.UseCount() == 2);
+            CHECK(copy->value == 5);
+        }
+        CHECK(ptr.UseCount() == 1);
+        auto moved = std::move(ptr);
+        CHECK(!ptr);
+        CHECK(moved.UseCount() == 1);
+    }
+    CHECK(Tracked::live == 0);
+}
+
+// Both counts live in one word, the weak half holds one extra reference for all the strong ones
+template <typename Policy>
+void CheckPackedCounts() {
+    WeakPtr<Tracked, Policy> first;
+    WeakPtr<Tracked, Policy> second;
+    ControlBlock<Policy>* block;
+    {
+        auto ptr = MakeShared<Tracked, Policy>(1);
+        block = ptr.GetBlock();
+        CHECK(Policy::Load(block->counts) == PackedCounts::kSoleOwner);
+        auto copy = ptr;
+        first = ptr;
+        second = copy;
+        uint64_t word = Policy::Load(block->counts);
+        CHECK(PackedCounts::Strong(word) == 2);
+        CHECK(PackedCounts::Weak(word) == 3);
+        copy.Reset();
+        CHECK(Policy::Load(block->counts) == 1 * PackedCounts::kStrong + 3 * PackedCounts::kWeak);
+    }
+    // The last strong release destroys the object and drops the shared weak reference
+    CHECK(Tracked::live == 0);
+    CHECK(first.Expired());
+    CHECK(!second.Lock());
+    CHECK(Policy::Load(block->counts) == 2 * PackedCounts::kWeak);
+    first.Reset();
+    CHECK(Policy::Load(block->counts) == PackedCounts::kWeak);
+    // The last weak release frees the block, which the sanitizer builds check
+    second.Reset();
+    CHECK(Tracked::live == 0);
+}
+
+}  // namespace
+
+TEST(PackedCountsSingleThreaded) {
+    CheckPackedCounts<SingleThreadedPolicy>();
+}
+
+TEST(PackedCountsAtomic) {
+    CheckPackedCounts<AtomicPolicy>();
+}
+
+TEST(CopyAndReleaseSingleThreaded) {
+    CheckCopyAndRelease<SingleThreadedPolicy>();
+}
+
+TEST(CopyAndReleaseAtomic) {
+    CheckCopyAndRelease<AtomicPolicy>();
+}
+
+TEST(FromNewAndReset) {
+    SharedPtr<Tracked> ptr(new Tracked(3));
+    CHECK(ptr.UseCount() == 1);
+    ptr.Reset(new Tracked(4));
+    CHECK(ptr->value == 4);
+    CHECK(Tracked::live == 1);
+    ptr.Reset();
+    CHECK(Tracked::live == 0);
+    CHECK(ptr.Get() == nullptr);
+}
+
+TEST(ConvertsToBase) {
+    SharedPtr<Derived> derived = MakeShared<Derived>();
+    SharedPtr<Base> base = derived;
+    CHECK(base.UseCount() == 2);
+    CHECK(base->base == 1);
+    CHECK(base == derived);
+}
+
+TEST(WeakPtrExpiresWithTheObject) {
+    WeakPtr<Tracked> weak;
+    {
+        auto ptr = MakeShared<Tracked>(1);
+        weak = ptr;
+        CHECK(!weak.Expired());
+        CHECK(weak.Lock()->value == 1);
+        CHECK(weak.TryLock() == ptr.Get());
+    }
+    CHECK(weak.Expired());
+    CHECK(!weak.Lock());
+    CHECK(weak.TryLock() == nullptr);
+    CHECK(Tracked::live == 0);
+    bool thrown = false;
+    try {
+        SharedPtr<Tracked> promoted(weak);
+    } catch (const BadWeakPtr&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+TEST(SharedFromThis) {
+    struct Self : EnableSharedFromThis<Self> {};
+    auto ptr = MakeShared<Self>();
+    auto again = ptr->SharedFromThis();
+    CHECK(again == ptr);
+    CHECK(ptr.UseCount() == 2);
+    CHECK(ptr->WeakFromThis().Lock() == ptr);
+}
+
+TEST(SharedFromThisInline) {
+    struct Self : EnableSharedFromThisInline<Self> {
+        int value = 3;
+    };
+    auto ptr = MakeShared<Self>();
+    CHECK(ptr->SharedFromThis() == ptr);
+    CHECK(ptr.UseCount() == 1);
+    WeakPtr<Self> weak = ptr->WeakFromThis();
+    CHECK(weak.Lock() == ptr);
+    ptr.Reset();
+    CHECK(weak.Expired());
+}
+
+#ifndef NDEBUG
+// The debug check reads the words in front of the object, which are zero here
+TEST(SharedFromThisInlineOnStrayObject) {
+    struct Self : EnableSharedFromThisInline<Self> {};
+    struct Holder {
+        void* before[4] = {};
+        Self object;
+    } holder;
+    bool thrown = false;
+    try {
+        holder.object.SharedFromThis();
+    } catch (const BadWeakPtr&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+#endif
+
+TEST(MakeSharedArray) {
+    {
+        auto array = MakeShared<Tracked[]>(10);
+        CHECK(Tracked::live == 10);
+        CHECK(reinterpret_cast<uintptr_t>(array.Get()) % kSharedArrayAlignment == 0);
+        array[3].value = 4;
+        WeakPtr<Tracked[]> weak(array);
+        CHECK(weak.Lock()[3].value == 4);
+        array.Reset();
+        CHECK(Tracked::live == 0);
+        CHECK(weak.Expired());
+    }
+    auto zeroed = MakeShared<int[5]>();
+    CHECK(zeroed[0] == 0 && zeroed[4] == 0);
+    auto aligned = MakeShared<double[], DefaultLockPolicy, 256>(3);
+    CHECK(reinterpret_cast<uintptr_t>(aligned.Get()) % 256 == 0);
+    auto buffer = MakeSharedForOverwrite<char[]>(1 << 20);
+    buffer[(1 << 20) - 1] = 'x';
+    CHECK(buffer[(1 << 20) - 1] == 'x');
+    auto empty = MakeShared<Tracked[]>(0);
+    CHECK(empty.UseCount() == 1);
+}
+
+TEST(ArrayFromNewUsesDeleteArray) {
+    {
+        SharedPtr<Tracked[]> array(new Tracked[4]);
+        CHECK(Tracked::live == 4);
+        auto copy = array;
+        CHECK(copy[1].value == 0);
+    }
+    CHECK(Tracked::live == 0);
+}
+
+// Elements built before the throw are destroyed, the memory is returned
+TEST(ArrayConstructorThrows) {
+    Fragile::left = 4;
+    bool thrown = false;
+    try {
+        MakeShared<Fragile[]>(8);
+    } catch (int) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(Tracked::live == 0);
+}
+
+// Large objects get an allocation of their own, returned while weak references remain
+TEST(LargeObjectsAreFreedBeforeTheBlock) {
+    using Large = Heavy<kMakeSharedInlineLimit + 1>;
+    auto ptr = MakeShared<Large>();
+    CHECK(Large::allocated == 1);
+    WeakPtr<Large> weak(ptr);
+    ptr.Reset();
+    CHECK(weak.Expired());
+    CHECK(Large::allocated == 0);
+
+    using Small = Heavy<16>;
+    auto inline_ptr = MakeShared<Small>();
+    CHECK(Small::allocated == 0);
+    auto out_of_line = MakeSharedOutOfLine<Small>();
+    CHECK(Small::allocated == 1);
+    WeakPtr<Small> small_weak(out_of_line);
+    out_of_line.Reset();
+    CHECK(Small::allocated == 0);
+}
+
+TEST(ShareN) {
+    {
+        auto ptr = MakeShared<Tracked>(1);
+        std::vector<SharedPtr<Tracked>> copies;
+        ShareN(ptr, 100, std::back_inserter(copies));
+        CHECK(copies.size() == 100);
+        CHECK(ptr.UseCount() == 101);
+        CHECK(copies[99] == ptr);
+
+        std::vector<SharedPtr<Tracked>> empties(3);
+        ShareN(SharedPtr<Tracked>(), 3, empties.begin());
+        CHECK(!empties[0]);
+
+        // The references not handed out are dropped again
+        std::vector<SharedPtr<Tracked>> partial;
+        bool thrown = false;
+        try {
+            ShareN(ptr, 10, ThrowingOutput{&partial, 4});
+        } catch (int) {
+            thrown = true;
+        }
+        CHECK(thrown);
+        CHECK(partial.size() == 4);
+        CHECK(ptr.UseCount() == 105);
+    }
+    CHECK(Tracked::live == 0);
+}
+
+TEST(ReleaseAll) {
+    std::vector<SharedPtr<Tracked>> objects;
+    for (int i = 0; i < 5; ++i) {
+        objects.push_back(MakeShared<Tracked>(i));
+    }
+    // Interleaved owners and empty pointers across several batches
+    std::vector<SharedPtr<Tracked>> ptrs;
+    for (size_t i = 0; i < 3 * kReleaseAllBatch + 7; ++i) {
+        ptrs.push_back(i % 7 == 0 ? SharedPtr<Tracked>() : objects[i % 5]);
+    }
+    WeakPtr<Tracked> weak(objects[0]);
+    objects.clear();
+    CHECK(Tracked::live == 5);
+    ReleaseAll(std::span<SharedPtr<Tracked>>(ptrs));
+    CHECK(Tracked::live == 0);
+    CHECK(weak.Expired());
+    CHECK(!ptrs[1]);
+
+    auto ptr = MakeShared<Tracked, AtomicPolicy>(2);
+    std::vector<SharedPtr<Tracked, AtomicPolicy>> copies;
+    ShareN(ptr, 1000, std::back_inserter(copies));
+    std::thread([&copies] { ReleaseAll(copies); }).join();
+    CHECK(copies.empty());
+    CHECK(ptr.UseCount() == 1);
+}
+
+// Copies and weak promotions of one object from several threads
+TEST(AtomicPolicyAcrossThreads) {
+    auto ptr = MakeShared<Tracked, AtomicPolicy>(7);
+    WeakPtr<Tracked, AtomicPolicy> weak(ptr);
+    std::vector<std::thread> threads;
+    std::atomic<int> wrong{0};
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&ptr, &weak, &wrong] {
+            for (int i = 0; i < 20000; ++i) {
+                auto copy = ptr;
+                auto locked = weak.Lock();
+                if (!locked || locked->value != 7) {
+                    wrong.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(wrong.load() == 0);
+    CHECK(ptr.UseCount() == 1);
+    ptr.Reset();
+    CHECK(weak.Expired());
+    CHECK(Tracked::live == 0);
+}
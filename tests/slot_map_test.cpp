@@ -0,0 +1,131 @@
+#include "harness.h"
+
+#include "slot_map.h"
+
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Entity {
+    std::string name;
+    int hp;
+
+    Entity(std::string n, int h) : name(std::move(n)), hp(h) {
+    }
+};
+
+size_t allocations = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* memory = std::malloc(size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+TEST(InsertGetErase) {
+    SlotMap<Entity> map;
+    static_assert(sizeof(SlotHandle<Entity>) == 8);
+    auto a = map.Insert("a", 1);
+    auto b = map.Insert("b", 2);
+    auto c = map.Insert("c", 3);
+    CHECK(map.Size() == 3);
+    CHECK(map.Get(b)->hp == 2);
+    CHECK(map.Erase(a));
+    CHECK(!map.Erase(a));
+    CHECK(!map.Get(a));
+    CHECK(!map.Contains(a));
+    CHECK(map.Get(c)->name == "c");
+    CHECK(map.Get(b)->name == "b");
+    CHECK(!map.Get(SlotHandle<Entity>{}));
+}
+
+TEST(SlotsAreReusedWithANewGeneration) {
+    SlotMap<Entity> map;
+    auto a = map.Insert("a", 1);
+    map.Erase(a);
+    auto b = map.Insert("b", 2);
+    CHECK(b.index == a.index);
+    CHECK(b.generation != a.generation);
+    CHECK(!map.Get(a));
+    CHECK(SlotHandle<Entity>::FromBits(b.ToBits()) == b);
+    map.Clear();
+    CHECK(map.Empty());
+    CHECK(!map.Get(b));
+}
+
+TEST(DenseIteration) {
+    SlotMap<Entity> map;
+    std::vector<SlotHandle<Entity>> handles;
+    for (int i = 0; i < 100; ++i) {
+        handles.push_back(map.Insert(std::to_string(i), i));
+    }
+    for (int i = 0; i < 100; i += 3) {
+        map.Erase(handles[i]);
+    }
+    int sum = 0;
+    for (const Entity& entity : map) {
+        sum += entity.hp;
+    }
+    int expected = 0;
+    for (int i = 0; i < 100; ++i) {
+        expected += i % 3 != 0 ? i : 0;
+    }
+    CHECK(sum == expected);
+    for (size_t i = 0; i < map.Size(); ++i) {
+        CHECK(map.Get(map.HandleAt(i)) == map.begin() + i);
+    }
+}
+
+// Insertions grow the storage geometrically, not by one element each
+TEST(InsertGrowsGeometrically) {
+    SlotMap<int> map;
+    size_t before = allocations;
+    for (int i = 0; i < 100000; ++i) {
+        map.Insert(i);
+    }
+    CHECK(allocations - before < 100);
+    CHECK(map.Size() == 100000);
+}
+
+TEST(ImporterTranslatesWeakPtrs) {
+    SlotMap<Entity> map;
+    auto first = MakeShared<Entity>("x", 10);
+    auto second = MakeShared<Entity>("y", 20);
+    WeakPtr<Entity> first_weak(first);
+    WeakPtr<Entity> second_weak(second);
+    SlotMapImporter<Entity> importer(map);
+    auto handle = importer.Import(std::move(first));
+    importer.Import(std::move(second));
+    CHECK(!first);
+    CHECK(first_weak.Expired());
+    CHECK(importer.Translate(first_weak) == handle);
+    CHECK(map.Get(importer.Translate(first_weak))->hp == 10);
+    CHECK(map.Get(importer.Translate(second_weak))->name == "y");
+    CHECK(!importer.Translate(WeakPtr<Entity>()));
+}
+
+TEST(ImporterSkipsEmptyOwners) {
+    SlotMap<Entity> map;
+    SlotMapImporter<Entity> importer(map);
+    CHECK(!importer.Import(SharedPtr<Entity>()));
+    auto expired = MakeShared<Entity>("x", 10);
+    WeakPtr<Entity> weak(expired);
+    expired.Reset();
+    CHECK(!importer.Import(std::move(expired)));
+    CHECK(map.Empty());
+    CHECK(!importer.Translate(weak));
+    CHECK(!importer.Translate(WeakPtr<Entity>()));
+}
@@ -0,0 +1,115 @@
+#include "harness.h"
+
+#include "snapshot.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Version {
+    static inline std::atomic<int> live{0};
+    // Written together, a torn read would see them differ
+    int first;
+    int second;
+
+    explicit Version(int v) : first(v), second(v) {
+        live.fetch_add(1);
+    }
+    ~Version() {
+        live.fetch_sub(1);
+    }
+};
+
+SharedPtr<Version, AtomicPolicy> Make(int value) {
+    return MakeShared<Version, AtomicPolicy>(value);
+}
+
+}  // namespace
+
+TEST(ReadLoadPublish) {
+    {
+        Snapshot<Version> empty;
+        CHECK(!empty.Read());
+        CHECK(!empty.Load());
+
+        Snapshot<Version> snapshot(Make(1));
+        {
+            auto current = snapshot.Read();
+            CHECK(current->first == 1);
+            CHECK((*current).second == 1);
+        }
+        SharedPtr<Version, AtomicPolicy> kept = snapshot.Load();
+        snapshot.Publish(Make(2));
+        CHECK(snapshot.Read()->first == 2);
+        CHECK(kept->first == 1);
+        CHECK(snapshot.Reclaim() == 0);
+        CHECK(Version::live.load() == 2);
+    }
+    CHECK(Version::live.load() == 0);
+}
+
+// A reader inside a guard keeps the version it saw
+TEST(GuardDelaysReclamation) {
+    Snapshot<Version> snapshot(Make(1));
+    {
+        auto current = snapshot.Read();
+        snapshot.Publish(Make(2));
+        CHECK(snapshot.Reclaim() == 1);
+        CHECK(current->first == 1);
+        CHECK(Version::live.load() == 2);
+    }
+    CHECK(snapshot.Reclaim() == 0);
+    CHECK(Version::live.load() == 1);
+}
+
+TEST(GuardOnAnotherThread) {
+    Snapshot<Version> snapshot(Make(1));
+    std::atomic<bool> reading{false};
+    std::atomic<bool> done{false};
+    std::thread reader([&] {
+        auto current = snapshot.Read();
+        reading.store(true);
+        while (!done.load()) {
+        }
+        CHECK(current->first == 1);
+    });
+    while (!reading.load()) {
+    }
+    snapshot.Publish(Make(2));
+    CHECK(snapshot.Reclaim() == 1);
+    done.store(true);
+    reader.join();
+    CHECK(snapshot.Reclaim() == 0);
+    CHECK(Version::live.load() == 1);
+}
+
+TEST(ConcurrentReadersAndWriter) {
+    {
+        Snapshot<Version> snapshot(Make(0));
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 3; ++t) {
+            readers.emplace_back([&snapshot, &stop] {
+                int last = 0;
+                while (!stop.load()) {
+                    auto current = snapshot.Read();
+                    CHECK(current->first == current->second);
+                    CHECK(current->first >= last);
+                    last = current->first;
+                }
+            });
+        }
+        for (int value = 1; value <= 2000; ++value) {
+            snapshot.Publish(Make(value));
+        }
+        stop.store(true);
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        CHECK(snapshot.Reclaim() == 0);
+        CHECK(Version::live.load() == 1);
+    }
+    CHECK(Version::live.load() == 0);
+}
@@ -0,0 +1,107 @@
+#include "harness.h"
+
+#include "weak_map.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Map = WeakValueMap<int, std::string>;
+using Value = SharedPtr<std::string, AtomicPolicy>;
+
+Value Make(int key) {
+    return MakeShared<std::string, AtomicPolicy>(std::to_string(key));
+}
+
+}  // namespace
+
+TEST(FindInsertErase) {
+    Map map;
+    Value one = Make(1);
+    CHECK(map.Insert(1, one) == one);
+    CHECK(map.Find(1) == one);
+    CHECK(!map.Find(2));
+    // A live value wins over a new one
+    CHECK(map.Insert(1, Make(10)) == one);
+    CHECK(map.Erase(1));
+    CHECK(!map.Erase(1));
+    CHECK(!map.Find(1));
+}
+
+TEST(EntriesExpireWithTheirValues) {
+    Map map;
+    Value kept = map.FindOrCreate(1, [] { return Make(1); });
+    map.FindOrCreate(2, [] { return Make(2); });
+    CHECK(map.Size() == 2);
+    CHECK(!map.Find(2));
+    CHECK(map.Size() == 1);
+    int created = 0;
+    Value again = map.FindOrCreate(1, [&created] {
+        ++created;
+        return Make(1);
+    });
+    CHECK(again == kept);
+    CHECK(created == 0);
+}
+
+TEST(SweepRemovesExpiredEntries) {
+    Map map(4);
+    std::vector<Value> live;
+    for (int key = 0; key < 1000; ++key) {
+        Value value = Make(key);
+        map.Insert(key, value);
+        if (key % 10 == 0) {
+            live.push_back(value);
+        }
+    }
+    while (map.Sweep(64) != 0 || map.Size() != live.size()) {
+    }
+    CHECK(map.Size() == live.size());
+    for (const Value& value : live) {
+        CHECK(map.Find(std::stoi(*value)) == value);
+    }
+}
+
+// Empty buckets count against the budget, so a small budget stays small on a sparse map
+TEST(SweepBudgetCoversEmptyBuckets) {
+    Map map(1);
+    for (int key = 0; key < 4096; ++key) {
+        map.Insert(key, Make(key));
+    }
+    for (int key = 0; key < 4096; ++key) {
+        map.Erase(key);
+    }
+    map.Insert(-1, Make(-1));
+    CHECK(map.Size() == 1);
+    size_t calls = 1;
+    while (map.Sweep(1) == 0 && calls < 100000) {
+        ++calls;
+    }
+    CHECK(map.Size() == 0);
+    // The sweep reached the entry bucket by bucket, not in one call over the whole table
+    CHECK(calls > 1);
+}
+
+TEST(ConcurrentFindOrCreate) {
+    Map map;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&map] {
+            for (int round = 0; round < 2000; ++round) {
+                int key = round % 64;
+                Value value = map.FindOrCreate(key, [key] { return Make(key); });
+                CHECK(*value == std::to_string(key));
+                if (round % 16 == 0) {
+                    map.Sweep(8);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    map.Sweep(1 << 20);
+    CHECK(map.Size() == 0);
+}
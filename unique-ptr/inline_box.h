@@ -0,0 +1,228 @@
+#pragma once
+
+#include "unique.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// `InlineBox<Base, N>` owns one object derived from `Base`, like `UniquePtr<Base>`, but keeps it
+// inside the box when it fits: objects of at most `N` bytes and `Align` alignment whose move
+// constructor does not throw live in the box's own buffer, anything else goes to the heap.
+// Moving a box moves an inline object into the new buffer and steals a heap one.
+//
+// The object is destroyed as its own type, so `Base` needs no virtual destructor, except for
+// `Release()`, which hands out a heap pointer to be deleted through `Base`.
+//
+// Usage:
+//     InlineBox<Handler> handler = MakeInlineBox<Handler, LogHandler>(...);
+//     handler->Handle(event);
+//     handler.Emplace<RetryHandler>(...);           // destroys the LogHandler
+template <typename Base, size_t N = 48, size_t Align = alignof(std::max_align_t)>
+class InlineBox {
+    // What the box does with an object of its concrete type
+    struct Ops {
+        // Moves an inline object to `to` and destroys it, nullptr for heap objects
+        Base* (*relocate)(Base* from, void* to) noexcept;
+        // Moves an inline object to the heap, nullptr for heap objects
+        Base* (*to_heap)(Base* from);
+        void (*destroy)(Base* ptr) noexcept;
+    };
+
+    template <typename D>
+    static constexpr bool kFitsInline = sizeof(D) <= N && alignof(D) <= Align &&
+                                        std::is_nothrow_move_constructible_v<D>;
+
+    template <typename D>
+    static constexpr Ops kInlineOps{
+        [](Base* from, void* to) noexcept -> Base* {
+            D* source = static_cast<D*>(from);
+            D* target = ::new (to) D(std::move(*source));
+            source->~D();
+            return target;
+        },
+        [](Base* from) -> Base* {
+            D* source = static_cast<D*>(from);
+            D* target = new D(std::move(*source));
+            source->~D();
+            return target;
+        },
+        [](Base* ptr) noexcept { static_cast<D*>(ptr)->~D(); }};
+
+    // `delete` spelled out: the object has exactly type `D`, but `delete` would warn when `D` is
+    // polymorphic without a virtual destructor
+    template <typename D>
+    static void DeleteHeap(Base* ptr) noexcept {
+        D* object = static_cast<D*>(ptr);
+        object->~D();
+        if constexpr (requires { D::operator delete(object); }) {
+            D::operator delete(object);
+        } else if constexpr (requires { D::operator delete(object, sizeof(D)); }) {
+            D::operator delete(object, sizeof(D));
+        } else if constexpr (alignof(D) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(object, std::align_val_t(alignof(D)));
+        } else {
+            ::operator delete(object);
+        }
+    }
+
+    template <typename D>
+    static constexpr Ops kHeapOps{nullptr, nullptr, &DeleteHeap<D>};
+
+    template <typename D>
+    void Check() {
+        static_assert(std::is_base_of_v<Base, D>, "The object must derive from Base");
+    }
+
+    template <typename D, typename... Args>
+    Base* Construct(Args&&... args) {
+        if constexpr (kFitsInline<D>) {
+            Base* ptr = ::new (static_cast<void*>(storage_)) D(std::forward<Args>(args)...);
+            ops_ = &kInlineOps<D>;
+            return ptr;
+        } else {
+            Base* ptr = new D(std::forward<Args>(args)...);
+            ops_ = &kHeapOps<D>;
+            return ptr;
+        }
+    }
+
+    // Takes the object of `other`, which must be empty here
+    void MoveFrom(InlineBox& other) noexcept {
+        if (other.ptr_ == nullptr) {
+            return;
+        }
+        ops_ = other.ops_;
+        if (ops_->relocate != nullptr) {
+            ptr_ = ops_->relocate(other.ptr_, storage_);
+        } else {
+            ptr_ = other.ptr_;
+        }
+        other.ptr_ = nullptr;
+        other.ops_ = nullptr;
+    }
+
+    alignas(Align) std::byte storage_[N];
+    Base* ptr_ = nullptr;
+    const Ops* ops_ = nullptr;
+
+public:
+    // Objects this small and aligned are stored inline
+    static constexpr size_t kInlineSize = N;
+    static constexpr size_t kInlineAlignment = Align;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    InlineBox() noexcept {
+    }
+    InlineBox(std::nullptr_t) noexcept {
+    }
+
+    template <typename D, typename... Args>
+    explicit InlineBox(std::in_place_type_t<D>, Args&&... args) {
+        Check<D>();
+        ptr_ = Construct<D>(std::forward<Args>(args)...);
+    }
+
+    // Adopts a heap object, for code moving over from `UniquePtr`
+    template <typename D>
+    InlineBox(UniquePtr<D>&& other) noexcept {
+        Check<D>();
+        if (other) {
+            ptr_ = other.Release();
+            ops_ = &kHeapOps<D>;
+        }
+    }
+
+    InlineBox(const InlineBox&) = delete;
+    InlineBox(InlineBox&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    InlineBox& operator=(const InlineBox&) = delete;
+    InlineBox& operator=(InlineBox&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+    InlineBox& operator=(std::nullptr_t) noexcept {
+        Reset();
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~InlineBox() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Replaces the object. The box is empty if the constructor throws.
+    template <typename D, typename... Args>
+    D& Emplace(Args&&... args) {
+        Check<D>();
+        Reset();
+        ptr_ = Construct<D>(std::forward<Args>(args)...);
+        return *static_cast<D*>(ptr_);
+    }
+
+    // Heap pointer to the object, which the caller deletes through `Base`. An inline object is
+    // moved to the heap first.
+    Base* Release() {
+        static_assert(std::has_virtual_destructor_v<Base>,
+                      "Release() hands out a pointer deleted through Base");
+        if (ptr_ == nullptr) {
+            return nullptr;
+        }
+        Base* ptr = ops_->to_heap != nullptr ? ops_->to_heap(ptr_) : ptr_;
+        ptr_ = nullptr;
+        ops_ = nullptr;
+        return ptr;
+    }
+    void Reset() noexcept {
+        if (Base* ptr = std::exchange(ptr_, nullptr); ptr != nullptr) {
+            std::exchange(ops_, nullptr)->destroy(ptr);
+        }
+    }
+    void Swap(InlineBox& other) noexcept {
+        InlineBox tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    Base* Get() const noexcept {
+        return ptr_;
+    }
+    Base& operator*() const noexcept {
+        return *ptr_;
+    }
+    Base* operator->() const noexcept {
+        return ptr_;
+    }
+    explicit operator bool() const noexcept {
+        return ptr_ != nullptr;
+    }
+    // True if the object lives in the box rather than on the heap
+    bool IsInline() const noexcept {
+        return ptr_ != nullptr && ops_->relocate != nullptr;
+    }
+};
+
+template <typename Base, typename D, size_t N = 48, size_t Align = alignof(std::max_align_t),
+          typename... Args>
+InlineBox<Base, N, Align> MakeInlineBox(Args&&... args) {
+    return InlineBox<Base, N, Align>(std::in_place_type<D>, std::forward<Args>(args)...);
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "unique.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define SMART_PTRS_LEAK_CHECKER 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(leak_sanitizer)
+#define SMART_PTRS_LEAK_CHECKER 1
+#endif
+#endif
+#ifdef SMART_PTRS_LEAK_CHECKER
+#include <sanitizer/lsan_interface.h>
+#endif
+
+// Recycling of hot objects: `ObjectPool<T>` keeps destroyed objects' memory on a lock-free free
+// list and hands it out again instead of going through the heap. `Acquire()` returns a ready
+// `UniquePtr<T, PoolDeleter<...>>` whose `Reset()` and destructor run `~T` and push the memory
+// back.
+//
+// Where the memory goes back to is chosen by the deleter's second parameter:
+//   * `PoolDeleter<T>` (`GlobalPool`): one process-wide pool per type, the deleter is empty;
+//   * `PoolDeleter<T, ThreadLocalPool>`: the pool of the releasing thread, empty as well;
+//   * `PoolDeleter<T, ObjectPool<T>>`: a pool object of your own, the deleter stores its address.
+// The empty ones take no space in `UniquePtr` thanks to `CompressedPair`.
+//
+// Every slot is a heap allocation of its own, so objects may be released on any thread and
+// migrate between the thread-local pools and the global one; an exiting thread hands its cached
+// slots to the global pool. A pool's memory stays at its high-water mark, only a pool object of
+// your own frees it, when destroyed. Its objects have to be returned to it before that.
+//
+// Usage:
+//     auto message = AcquirePooled<Message>();      // UniquePtr<Message, PoolDeleter<Message>>
+//     ...
+//     message.Reset();                              // back to ObjectPool<Message>::Global()
+
+// Counters of one pool
+struct ObjectPoolStats {
+    size_t acquires = 0;
+    // Acquires served from the free list
+    size_t hits = 0;
+    size_t live = 0;
+    size_t high_water = 0;
+
+    double HitRate() const {
+        return acquires != 0 ? static_cast<double>(hits) / static_cast<double>(acquires) : 0.0;
+    }
+};
+
+template <typename T>
+class ObjectPool;
+
+// Tags of `PoolDeleter`
+struct GlobalPool {};
+struct ThreadLocalPool {};
+
+template <typename T, typename Where = GlobalPool>
+struct PoolDeleter {
+    void operator()(T* ptr) const {
+        if constexpr (std::is_same_v<Where, ThreadLocalPool>) {
+            ObjectPool<T>::ThreadLocal().Destroy(ptr);
+        } else {
+            ObjectPool<T>::Global().Destroy(ptr);
+        }
+    }
+};
+
+// Bound to a pool object
+template <typename T>
+struct PoolDeleter<T, ObjectPool<T>> {
+    ObjectPool<T>* pool = nullptr;
+
+    void operator()(T* ptr) const {
+        pool->Destroy(ptr);
+    }
+};
+
+template <typename T>
+class ObjectPool {
+public:
+    static_assert(sizeof(void*) == 8, "ObjectPool packs pointers into 48 bits");
+
+    ObjectPool() = default;
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // Frees the cached memory. Objects still out must not come back here.
+    ~ObjectPool() {
+        while (Slot* slot = Pop()) {
+            if (heir_ != nullptr) {
+                heir_->Push(slot);
+            } else {
+                delete slot;
+            }
+        }
+    }
+
+    // Never destroyed, so objects may be returned during static destruction
+    static ObjectPool& Global() {
+        static ObjectPool* pool = new ObjectPool();
+        return *pool;
+    }
+    static ObjectPool& ThreadLocal() {
+        thread_local ObjectPool pool(&Global());
+        return pool;
+    }
+
+    // Constructs an object in recycled memory if there is some
+    template <typename... Args>
+    T* Create(Args&&... args) {
+        acquires_.fetch_add(1, std::memory_order_relaxed);
+        Slot* slot = Pop();
+        if (slot != nullptr) {
+            hits_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            slot = NewSlot();
+        }
+        T* ptr;
+        try {
+            ptr = ::new (static_cast<void*>(slot->storage)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            Push(slot);
+            throw;
+        }
+        ptrdiff_t live = live_.fetch_add(1, std::memory_order_relaxed) + 1;
+        ptrdiff_t high_water = high_water_.load(std::memory_order_relaxed);
+        while (live > high_water &&
+               !high_water_.compare_exchange_weak(high_water, live, std::memory_order_relaxed)) {
+        }
+        return ptr;
+    }
+
+    // Destroys an object and keeps its memory. Objects of the global and thread-local pools may
+    // go to any of them, those of a pool object of your own only back to it.
+    void Destroy(T* ptr) {
+        ptr->~T();
+        live_.fetch_sub(1, std::memory_order_relaxed);
+        Push(SlotOf(ptr));
+    }
+
+    template <typename... Args>
+    UniquePtr<T, PoolDeleter<T, ObjectPool>> Acquire(Args&&... args) {
+        return UniquePtr<T, PoolDeleter<T, ObjectPool>>(Create(std::forward<Args>(args)...),
+                                                        PoolDeleter<T, ObjectPool>{this});
+    }
+
+    // Relaxed snapshot, the counters may be mutually inconsistent under concurrency
+    ObjectPoolStats Stats() const {
+        ObjectPoolStats stats;
+        stats.acquires = acquires_.load(std::memory_order_relaxed);
+        stats.hits = hits_.load(std::memory_order_relaxed);
+        ptrdiff_t live = live_.load(std::memory_order_relaxed);
+        stats.live = static_cast<size_t>(std::max<ptrdiff_t>(live, 0));
+        stats.high_water = static_cast<size_t>(high_water_.load(std::memory_order_relaxed));
+        return stats;
+    }
+
+private:
+    // The link lives outside the object storage, so a stale reader of a slot that has been
+    // handed out again never races with the object's own writes
+    struct Slot {
+        std::atomic<Slot*> next{nullptr};
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    // The free list head: slot address in the low 48 bits, a tag bumped by every update in the
+    // high 16 bits against ABA
+    static constexpr int kTagShift = 48;
+    static constexpr uint64_t kPointerMask = (uint64_t{1} << kTagShift) - 1;
+    static constexpr uint64_t kTagOne = uint64_t{1} << kTagShift;
+
+    static Slot* NewSlot() {
+        auto slot = new Slot;
+#ifdef SMART_PTRS_LEAK_CHECKER
+        // Cached slots are only reachable through the tagged head, which a leak checker does not
+        // recognize as a pointer, and the global pool keeps them for good
+        __lsan_ignore_object(slot);
+#endif
+        return slot;
+    }
+    static Slot* SlotOf(T* ptr) {
+        auto storage = reinterpret_cast<std::byte*>(ptr);
+        return reinterpret_cast<Slot*>(storage - offsetof(Slot, storage));
+    }
+    static Slot* PointerOf(uint64_t head) {
+        return reinterpret_cast<Slot*>(head & kPointerMask);
+    }
+    static uint64_t Pack(Slot* slot, uint64_t old_head) {
+        return reinterpret_cast<uint64_t>(slot) | ((old_head & ~kPointerMask) + kTagOne);
+    }
+
+    // A slot that can be on a shared list is never freed, so reading `next` of a slot another
+    // thread has just popped is safe; the tag makes the CAS fail
+    Slot* Pop() {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        while (Slot* slot = PointerOf(head)) {
+            Slot* next = slot->next.load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, Pack(next, head), std::memory_order_acquire,
+                                            std::memory_order_acquire)) {
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+    void Push(Slot* slot) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        do {
+            slot->next.store(PointerOf(head), std::memory_order_relaxed);
+        } while (!head_.compare_exchange_weak(head, Pack(slot, head), std::memory_order_release,
+                                              std::memory_order_relaxed));
+    }
+
+    // Pool destructor's recipient of the cached slots, deletes them if nullptr
+    explicit ObjectPool(ObjectPool* heir) : heir_(heir) {
+    }
+
+    ObjectPool* heir_ = nullptr;
+    std::atomic<uint64_t> head_{0};
+    std::atomic<size_t> acquires_{0};
+    std::atomic<size_t> hits_{0};
+    // Goes negative in a thread-local pool that gets back more objects than it handed out
+    std::atomic<ptrdiff_t> live_{0};
+    std::atomic<ptrdiff_t> high_water_{0};
+};
+
+// `Acquire()` from the pool `Where` names, see above
+template <typename T, typename Where = GlobalPool, typename... Args>
+UniquePtr<T, PoolDeleter<T, Where>> AcquirePooled(Args&&... args) {
+    if constexpr (std::is_same_v<Where, ThreadLocalPool>) {
+        return UniquePtr<T, PoolDeleter<T, Where>>(
+            ObjectPool<T>::ThreadLocal().Create(std::forward<Args>(args)...));
+    } else {
+        return UniquePtr<T, PoolDeleter<T, Where>>(
+            ObjectPool<T>::Global().Create(std::forward<Args>(args)...));
+    }
+}
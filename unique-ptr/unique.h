@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../common/instrumentation.h"
+#include "../common/relocation.h"
 #include "compressed_pair.h"
 
 #include <cstddef>  // std::nullptr_t
@@ -28,8 +30,9 @@ struct DefaultDeleter<T[]> {
 };
 
 // Primary template
+// Passed in registers in the trivial ABI mode, see common/relocation.h
 template <typename T, typename Deleter = DefaultDeleter<T>>
-class UniquePtr {
+class SMART_PTRS_TRIVIAL_ABI_ATTRIBUTE UniquePtr {
     CompressedPair<T*, Deleter> data_;
 
 public:
@@ -39,6 +42,12 @@ public:
     explicit UniquePtr(T* ptr = nullptr) noexcept : data_(ptr, Deleter{}){};
     UniquePtr(T* ptr, Deleter deleter) noexcept : data_(ptr, std::forward<Deleter>(deleter)){};
 
+    // Not covered by the template below, a class needs a move constructor of its own to be
+    // passed in registers
+    UniquePtr(UniquePtr&& other) noexcept {
+        data_.GetFirst() = other.Release();
+        data_.GetSecond() = std::forward<Deleter>(other.GetDeleter());
+    };
     template <class K, class DD>
     UniquePtr(UniquePtr<K, DD>&& other) noexcept {
         data_.GetFirst() = other.Release();
@@ -73,6 +82,7 @@ public:
 
     ~UniquePtr() {
         if (data_.GetFirst()) {
+            StatsHandle::OnUniqueDelete<T>();
             data_.GetSecond()(data_.GetFirst());
         }
     };
@@ -89,6 +99,7 @@ public:
         auto obj = data_.GetFirst();
         data_.GetFirst() = ptr;
         if (obj != nullptr) {
+            StatsHandle::OnUniqueDelete<T>();
             data_.GetSecond()(obj);
         }
     };
@@ -123,9 +134,13 @@ public:
     };
 };
 
+// Relocatable with `memcpy` as long as the deleter is, see common/relocation.h
+template <typename T, typename Deleter>
+struct IsTriviallyRelocatable<UniquePtr<T, Deleter>> : IsTriviallyRelocatable<Deleter> {};
+
 // Specialization for arrays
 template <typename T, typename Deleter>
-class UniquePtr<T[], Deleter> {
+class SMART_PTRS_TRIVIAL_ABI_ATTRIBUTE UniquePtr<T[], Deleter> {
     CompressedPair<T*, Deleter> data_;
 
 public:
@@ -158,6 +173,7 @@ public:
 
     ~UniquePtr() {
         if (data_.GetFirst()) {
+            StatsHandle::OnUniqueDelete<T>();
             data_.GetSecond()(data_.GetFirst());
         }
     };
@@ -174,6 +190,7 @@ public:
         auto obj = data_.GetFirst();
         data_.GetFirst() = ptr;
         if (obj != nullptr) {
+            StatsHandle::OnUniqueDelete<T>();
             data_.GetSecond()(obj);
         }
     };